@@ -13,6 +13,21 @@ Admin.SocketBroker({
 	onSocketOpen: function() {
 		this.socket.send('getModuleInfo'); // 取得本模組資訊
 		this.socket.send('getList'); // 取得 Mac IP 列表
+		this.socket.send('getMigrationStatus'); // 取得倉庫搬移進度
+		this.socket.send('getMaintenanceStatus'); // 取得倉庫用量
+		this.socket.send('getCacheStatus'); // 取得記憶體快取統計
+
+		document.getElementById('refreshMaintenance').onclick = function() {
+			this.socket.send('getMaintenanceStatus');
+		}.bind(this);
+
+		document.getElementById('refreshCache').onclick = function() {
+			this.socket.send('getCacheStatus');
+		}.bind(this);
+
+		document.getElementById('migrateButton').onclick = function() {
+			this.socket.send('migrateRepository');
+		}.bind(this);
 	},
 
 	onSocketClose: function() {
@@ -59,6 +74,18 @@ Admin.SocketBroker({
 			let json = JSON.parse(textMsg.substring(textMsg.indexOf('{')));
 			let listItem = this._getHostItem(document.getElementById('datarecord_' + json.id));
 			listItem.setData(json);
+		// 倉庫搬移進度
+		} else if (textMsg.startsWith('migrationStatus ')) {
+			let json = JSON.parse(textMsg.substring(textMsg.indexOf('{')));
+			this._showMigrationStatus(json);
+		// 倉庫用量及背景維護結果
+		} else if (textMsg.startsWith('maintenanceStatus ')) {
+			let json = JSON.parse(textMsg.substring(textMsg.indexOf('{')));
+			this._showMaintenanceStatus(json);
+		// 記憶體快取統計
+		} else if (textMsg.startsWith('cacheStatus ')) {
+			let json = JSON.parse(textMsg.substring(textMsg.indexOf('{')));
+			this._showCacheStatus(json);
 		} else if (textMsg.startsWith('deleteSource ')) {
 			const array = textMsg.split(' ');
 			const id = array[1];
@@ -69,6 +96,76 @@ Admin.SocketBroker({
 		}
 	},
 
+	/**
+	 * 顯示倉庫搬移進度，搬移中每秒更新一次
+	 * @param {object} status - {running: 是否搬移中, migrated: 已處理數, total: 總數}
+	 */
+	_showMigrationStatus: function(status) {
+		const percent = status.total > 0 ? Math.round(status.migrated * 100 / status.total) : 0;
+		const progress = document.getElementById('migrationProgress');
+		progress.style.width = percent + '%';
+		progress.innerText = percent + '%';
+		document.getElementById('migrationText').innerText = status.migrated + ' / ' + status.total;
+		document.getElementById('migrateButton').disabled = status.running;
+
+		if (status.running) {
+			setTimeout(function() {
+				this.socket.send('getMigrationStatus');
+			}.bind(this), 1000);
+		}
+	},
+
+	/**
+	 * 顯示倉庫用量及背景維護結果
+	 * @param {object} status - {usedBytes, quotaBytes, reclaimedBytes, reclaimedFiles, lastRun}
+	 */
+	_showMaintenanceStatus: function(status) {
+		const formatSize = this._formatSize;
+
+		const percent = status.quotaBytes > 0 ? Math.min(100, Math.round(status.usedBytes * 100 / status.quotaBytes)) : 0;
+		const progress = document.getElementById('quotaProgress');
+		progress.style.width = percent + '%';
+		progress.innerText = status.quotaBytes > 0 ? percent + '%' : '';
+		progress.classList.toggle('bg-danger', percent >= 90);
+
+		document.getElementById('usedBytes').innerText = formatSize(status.usedBytes);
+		document.getElementById('quotaBytes').innerText = status.quotaBytes > 0 ? formatSize(status.quotaBytes) : _('Unlimited');
+		document.getElementById('reclaimed').innerText = formatSize(status.reclaimedBytes) + ' (' + status.reclaimedFiles + ')';
+		document.getElementById('lastMaintenance').innerText = status.lastRun > 0 ? new Date(status.lastRun * 1000).toLocaleString() : '-';
+	},
+
+	/**
+	 * 顯示記憶體快取統計
+	 * @param {object} status - {hits, misses, residentBytes, capacity, entries}
+	 */
+	_showCacheStatus: function(status) {
+		const requests = status.hits + status.misses;
+		const percent = status.capacity > 0 ? Math.min(100, Math.round(status.residentBytes * 100 / status.capacity)) : 0;
+		const progress = document.getElementById('cacheProgress');
+		progress.style.width = percent + '%';
+		progress.innerText = status.capacity > 0 ? percent + '%' : '';
+
+		document.getElementById('cacheHitRatio').innerText = requests > 0 ?
+			(status.hits * 100 / requests).toFixed(1) + '% (' + status.hits + ' / ' + requests + ')' : '-';
+		document.getElementById('cacheResident').innerText = status.capacity > 0 ?
+			this._formatSize(status.residentBytes) + ' / ' + this._formatSize(status.capacity) : _('Disabled');
+		document.getElementById('cacheEntries').innerText = status.entries;
+	},
+
+	/**
+	 * 把 bytes 轉成易讀的大小
+	 * @param {number} bytes
+	 */
+	_formatSize: function(bytes) {
+		const units = ['B', 'KB', 'MB', 'GB', 'TB'];
+		let i = 0;
+		while (bytes >= 1024 && i < units.length - 1) {
+			bytes /= 1024;
+			i++;
+		}
+		return (i === 0 ? bytes : bytes.toFixed(1)) + ' ' + units[i];
+	},
+
 	/**
 	 * 把來源資訊放到 container 所在的 html 容器內
 	 * @param {string} container - elemeny id.
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// @brief 兩個版本檔案之間的二進位差異(類似 rsync 的區塊比對)
+///
+/// 差異檔格式(數值皆爲 little-endian):
+///   "TRD1"                            檔頭
+///   uint64 目標檔案大小
+///   之後是一連串指令:
+///   0x01 uint64 offset, uint32 length 從舊版本 offset 處複製 length bytes
+///   0x02 uint32 length, bytes...      直接附加 length bytes
+namespace BinaryDelta
+{
+    constexpr char Magic[] = "TRD1";
+    constexpr unsigned char OpCopy = 0x01;
+    constexpr unsigned char OpAdd = 0x02;
+
+    namespace detail
+    {
+        inline void putUInt(std::string& out, std::uint64_t value, const int bytes)
+        {
+            for (int i = 0; i < bytes; i++)
+            {
+                out += static_cast<char>(value & 0xff);
+                value >>= 8;
+            }
+        }
+
+        inline bool getUInt(const std::string& in, std::size_t& pos, std::uint64_t& value,
+                            const int bytes)
+        {
+            if (pos + bytes > in.size())
+                return false;
+
+            value = 0;
+            for (int i = bytes - 1; i >= 0; i--)
+                value = (value << 8) | static_cast<unsigned char>(in[pos + i]);
+            pos += bytes;
+            return true;
+        }
+
+        /// @brief rsync 的弱雜湊，可以逐 byte 滾動計算
+        struct RollingHash
+        {
+            std::uint32_t a = 0;
+            std::uint32_t b = 0;
+            std::size_t length = 0;
+
+            void init(const unsigned char* data, const std::size_t len)
+            {
+                a = b = 0;
+                length = len;
+                for (std::size_t i = 0; i < len; i++)
+                {
+                    a += data[i];
+                    b += static_cast<std::uint32_t>(len - i) * data[i];
+                }
+            }
+
+            void roll(const unsigned char out, const unsigned char in)
+            {
+                a += in - out;
+                b += a - static_cast<std::uint32_t>(length) * out;
+            }
+
+            std::uint32_t digest() const { return (a & 0xffff) | (b << 16); }
+        };
+
+        inline void emitAdd(std::string& delta, const std::string& target,
+                            std::size_t begin, const std::size_t end)
+        {
+            while (begin < end)
+            {
+                const std::size_t length = std::min<std::size_t>(end - begin, UINT32_MAX);
+                delta += static_cast<char>(OpAdd);
+                putUInt(delta, length, 4);
+                delta.append(target, begin, length);
+                begin += length;
+            }
+        }
+
+        inline void emitCopy(std::string& delta, const std::size_t offset, std::size_t length)
+        {
+            std::size_t pos = offset;
+            while (length > 0)
+            {
+                const std::size_t chunk = std::min<std::size_t>(length, UINT32_MAX);
+                delta += static_cast<char>(OpCopy);
+                putUInt(delta, pos, 8);
+                putUInt(delta, chunk, 4);
+                pos += chunk;
+                length -= chunk;
+            }
+        }
+    }
+
+    /// @brief 產生從 source 到 target 的差異
+    inline std::string create(const std::string& source, const std::string& target,
+                              const std::size_t blockSize = 1024)
+    {
+        std::string delta(Magic, 4);
+        detail::putUInt(delta, target.size(), 8);
+
+        const auto* src = reinterpret_cast<const unsigned char*>(source.data());
+        const auto* dst = reinterpret_cast<const unsigned char*>(target.data());
+
+        // 舊版本依區塊建立索引
+        std::unordered_map<std::uint32_t, std::vector<std::size_t>> blocks;
+        for (std::size_t offset = 0; offset + blockSize <= source.size(); offset += blockSize)
+        {
+            detail::RollingHash hash;
+            hash.init(src + offset, blockSize);
+            blocks[hash.digest()].push_back(offset);
+        }
+
+        std::size_t literal = 0; // 尚未輸出的新資料起點
+        std::size_t pos = 0;
+        detail::RollingHash hash;
+        bool hashValid = false;
+        while (pos + blockSize <= target.size() && !blocks.empty())
+        {
+            if (!hashValid)
+            {
+                hash.init(dst + pos, blockSize);
+                hashValid = true;
+            }
+
+            // 找出相同的區塊
+            std::size_t matchOffset = 0;
+            bool matched = false;
+            if (auto it = blocks.find(hash.digest()); it != blocks.end())
+            {
+                for (const std::size_t offset : it->second)
+                {
+                    if (std::memcmp(src + offset, dst + pos, blockSize) == 0)
+                    {
+                        matchOffset = offset;
+                        matched = true;
+                        break;
+                    }
+                }
+            }
+
+            if (!matched)
+            {
+                if (pos + blockSize < target.size())
+                    hash.roll(dst[pos], dst[pos + blockSize]);
+                else
+                    hashValid = false;
+                pos++;
+                continue;
+            }
+
+            // 往前延伸(吃掉一部分待輸出的新資料)
+            std::size_t start = pos;
+            std::size_t srcStart = matchOffset;
+            while (start > literal && srcStart > 0 && src[srcStart - 1] == dst[start - 1])
+            {
+                start--;
+                srcStart--;
+            }
+
+            // 往後延伸
+            std::size_t end = pos + blockSize;
+            std::size_t srcEnd = matchOffset + blockSize;
+            while (end < target.size() && srcEnd < source.size() && src[srcEnd] == dst[end])
+            {
+                end++;
+                srcEnd++;
+            }
+
+            detail::emitAdd(delta, target, literal, start);
+            detail::emitCopy(delta, srcStart, end - start);
+
+            literal = pos = end;
+            hashValid = false;
+        }
+
+        detail::emitAdd(delta, target, literal, target.size());
+        return delta;
+    }
+
+    /// @brief 把差異套用到 source，產生新版本
+    /// @return false - 差異檔格式錯誤或與 source 不符
+    inline bool apply(const std::string& source, const std::string& delta, std::string& target)
+    {
+        if (delta.size() < 12 || delta.compare(0, 4, Magic, 4) != 0)
+            return false;
+
+        std::size_t pos = 4;
+        std::uint64_t targetSize = 0;
+        detail::getUInt(delta, pos, targetSize, 8);
+
+        target.clear();
+        target.reserve(targetSize);
+        while (pos < delta.size())
+        {
+            const unsigned char op = delta[pos++];
+            std::uint64_t offset = 0;
+            std::uint64_t length = 0;
+            if (op == OpCopy)
+            {
+                if (!detail::getUInt(delta, pos, offset, 8) || !detail::getUInt(delta, pos, length, 4)
+                    || offset + length > source.size())
+                    return false;
+                target.append(source, offset, length);
+            }
+            else if (op == OpAdd)
+            {
+                if (!detail::getUInt(delta, pos, length, 4) || pos + length > delta.size())
+                    return false;
+                target.append(delta, pos, length);
+                pos += length;
+            }
+            else
+                return false;
+        }
+
+        return target.size() == targetSize;
+    }
+}
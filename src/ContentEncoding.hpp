@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include <Poco/DeflatingStream.h>
+#include <Poco/String.h>
+#include <Poco/StringTokenizer.h>
+
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/// @brief 依據 client 的 Accept-Encoding 壓縮文字型態的回應內容
+///        優先使用 zstd(編譯時有 libzstd 才支援)，其次 gzip
+namespace ContentEncoding
+{
+    enum Type {IDENTITY = 0, GZIP, ZSTD, COUNT};
+
+    /// 壓縮等級，壓縮結果會被快取，取較高的壓縮率
+    constexpr int GzipLevel = 9;
+    constexpr int ZstdLevel = 9;
+
+    /// @brief Content-Encoding header 的值
+    inline const char* name(const Type type)
+    {
+        static constexpr const char* Names[] = {"identity", "gzip", "zstd"};
+        return Names[type];
+    }
+
+    /// @brief 是否值得壓縮，範本檔案(ODF 等)本身就是 zip，不再壓縮
+    inline bool isCompressible(const std::string& mimeType)
+    {
+        return Poco::startsWith(mimeType, std::string("text/"))
+            || mimeType.find("json") != std::string::npos
+            || mimeType.find("xml") != std::string::npos
+            || mimeType.find("yaml") != std::string::npos;
+    }
+
+    /// @brief 從 Accept-Encoding 選出要使用的壓縮方式
+    inline Type negotiate(const std::string& acceptEncoding)
+    {
+        bool gzip = false;
+        bool zstd = false;
+        const Poco::StringTokenizer codings(acceptEncoding, ",",
+            Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        for (const auto& coding : codings)
+        {
+            // 例如 "gzip;q=0.8"，q=0 表示不接受
+            const Poco::StringTokenizer params(coding, ";", Poco::StringTokenizer::TOK_TRIM);
+            bool accepted = true;
+            for (std::size_t i = 1; i < params.count(); i++)
+            {
+                if (Poco::startsWith(params[i], std::string("q=")))
+                    accepted = std::atof(params[i].c_str() + 2) > 0;
+            }
+            if (!accepted)
+                continue;
+
+            const std::string token = Poco::toLower(params[0]);
+            if (token == "gzip" || token == "x-gzip" || token == "*")
+                gzip = true;
+            if (token == "zstd" || token == "*")
+                zstd = true;
+        }
+
+#if HAVE_ZSTD
+        if (zstd)
+            return ZSTD;
+#else
+        (void)zstd;
+#endif
+        return gzip ? GZIP : IDENTITY;
+    }
+
+    /// @brief 壓縮內容，失敗時傳回空字串
+    inline std::string encode(const std::string& body, const Type type)
+    {
+        switch (type)
+        {
+            case GZIP:
+            {
+                std::ostringstream oss;
+                Poco::DeflatingOutputStream deflater(oss,
+                    Poco::DeflatingStreamBuf::STREAM_GZIP, GzipLevel);
+                deflater.write(body.data(), body.size());
+                deflater.close();
+                return oss.str();
+            }
+
+#if HAVE_ZSTD
+            case ZSTD:
+            {
+                std::string out(ZSTD_compressBound(body.size()), '\0');
+                const std::size_t size = ZSTD_compress(&out[0], out.size(),
+                                                       body.data(), body.size(), ZstdLevel);
+                if (ZSTD_isError(size))
+                    return std::string();
+                out.resize(size);
+                return out;
+            }
+#endif
+
+            default:
+                return body;
+        }
+    }
+}
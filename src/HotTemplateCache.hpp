@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// @brief 把最常被下載的範本內容放在記憶體，容量有上限
+///        以 count-min sketch 估計每個範本(endpt)最近的存取次數(TinyLFU)，
+///        快取已滿時，新範本的存取次數要比即將被移除的範本多才會放入，
+///        一次性的大量同步不會把常用範本擠出快取
+///        同一個 endpt 只保留一個版本，版本檔名不同就視爲未命中
+class HotTemplateCache
+{
+public:
+    explicit HotTemplateCache(const std::size_t capacity)
+        : mCapacity(capacity)
+        , mMaxEntrySize(capacity / 8)
+        , mSketch(SketchDepth * SketchWidth, 0)
+        , mSamples(0)
+        , mResidentBytes(0)
+        , mHits(0)
+        , mMisses(0)
+    {
+    }
+
+    HotTemplateCache(const HotTemplateCache&) = delete;
+    HotTemplateCache& operator=(const HotTemplateCache&) = delete;
+
+    /// @brief 取得範本內容，並記錄一次存取
+    /// @param endpt 範本代碼
+    /// @param file 目前版本的檔名
+    /// @return 未命中時傳回 nullptr
+    std::shared_ptr<const std::string> get(const std::string& endpt, const std::string& file)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        increment(endpt);
+
+        if (auto it = mIndex.find(endpt); it != mIndex.end())
+        {
+            if (it->second->file == file)
+            {
+                mLru.splice(mLru.begin(), mLru, it->second);
+                ++mHits;
+                return it->second->data;
+            }
+
+            // 已經是舊版本
+            erase(it);
+        }
+        ++mMisses;
+        return nullptr;
+    }
+
+    /// @brief 是否值得放入快取(未命中後呼叫，決定要不要讀取整個檔案)
+    bool shouldAdmit(const std::string& endpt, const std::size_t size)
+    {
+        if (mCapacity == 0 || size > mMaxEntrySize)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        return admissible(endpt, size);
+    }
+
+    /// @brief 放入快取，不符合放入條件時不做任何事
+    void put(const std::string& endpt, const std::string& file,
+             const std::shared_ptr<const std::string>& data)
+    {
+        if (mCapacity == 0 || data->size() > mMaxEntrySize)
+            return;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (auto it = mIndex.find(endpt); it != mIndex.end())
+            erase(it);
+
+        if (!admissible(endpt, data->size()))
+            return;
+
+        while (mResidentBytes + data->size() > mCapacity && !mLru.empty())
+            erase(mIndex.find(mLru.back().endpt));
+
+        mLru.push_front(Entry{endpt, file, data});
+        mIndex[endpt] = mLru.begin();
+        mResidentBytes += data->size();
+    }
+
+    std::size_t getCapacity() const { return mCapacity; }
+    std::size_t getResidentBytes() const { return mResidentBytes; }
+    unsigned long getHits() const { return mHits; }
+    unsigned long getMisses() const { return mMisses; }
+
+    std::size_t getEntries()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mIndex.size();
+    }
+
+private:
+    struct Entry
+    {
+        std::string endpt;
+        std::string file;
+        std::shared_ptr<const std::string> data;
+    };
+
+    /// @brief 依序比較會被移除的範本，新範本的存取次數都比較多才放入，必須持有 mMutex
+    bool admissible(const std::string& endpt, const std::size_t size)
+    {
+        const unsigned int frequency = estimate(endpt);
+        std::size_t freed = 0;
+        for (auto it = mLru.rbegin(); it != mLru.rend(); ++it)
+        {
+            if (mResidentBytes - freed + size <= mCapacity)
+                break;
+
+            if (estimate(it->endpt) >= frequency)
+                return false;
+            freed += it->data->size();
+        }
+        return true;
+    }
+
+    /// @brief 移除快取項目，必須持有 mMutex
+    void erase(const std::unordered_map<std::string, std::list<Entry>::iterator>::iterator& it)
+    {
+        mResidentBytes -= it->second->data->size();
+        mLru.erase(it->second);
+        mIndex.erase(it);
+    }
+
+    /// @brief 在 sketch 每一列中的位置
+    std::array<std::size_t, 4> positions(const std::string& key) const
+    {
+        const std::uint64_t hash = std::hash<std::string>()(key);
+        const std::uint64_t step = ((hash * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+        std::array<std::size_t, 4> result;
+        for (std::size_t row = 0; row < SketchDepth; row++)
+            result[row] = row * SketchWidth + (hash + row * step) % SketchWidth;
+        return result;
+    }
+
+    /// @brief 記錄一次存取，累計一定次數後全部減半，讓過去的熱門範本逐漸淡出
+    void increment(const std::string& key)
+    {
+        for (const std::size_t pos : positions(key))
+        {
+            if (mSketch[pos] < MaxCount)
+                ++mSketch[pos];
+        }
+
+        if (++mSamples >= SketchWidth * 10)
+        {
+            for (auto& counter : mSketch)
+                counter >>= 1;
+            mSamples = 0;
+        }
+    }
+
+    /// @brief 估計的存取次數(各列最小值)
+    unsigned int estimate(const std::string& key) const
+    {
+        unsigned int result = MaxCount;
+        for (const std::size_t pos : positions(key))
+            result = std::min<unsigned int>(result, mSketch[pos]);
+        return result;
+    }
+
+private:
+    static constexpr std::size_t SketchDepth = 4;
+    static constexpr std::size_t SketchWidth = 8192;
+    static constexpr std::uint8_t MaxCount = 255;
+
+    const std::size_t mCapacity;
+    /// 單一範本最大可佔用量，避免一個大檔案佔滿快取
+    const std::size_t mMaxEntrySize;
+
+    std::mutex mMutex;
+    std::vector<std::uint8_t> mSketch;
+    std::size_t mSamples;
+    /// 快取項目，最近使用的在前面
+    std::list<Entry> mLru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> mIndex;
+    std::atomic<std::size_t> mResidentBytes;
+    std::atomic<unsigned long> mHits;
+    std::atomic<unsigned long> mMisses;
+};
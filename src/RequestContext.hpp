@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <net/Socket.hpp>
+
+#include <Poco/File.h>
+#include <Poco/FileStream.h>
+#include <Poco/MemoryStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/TemporaryFile.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTMLForm.h>
+#include <Poco/Net/MessageHeader.h>
+#include <Poco/Net/NameValueCollection.h>
+#include <Poco/Net/PartHandler.h>
+#include <Poco/JSON/Parser.h>
+#include <Poco/URI.h>
+
+/// @brief 把上傳的檔案存到模組的暫存目錄，異常中斷時留下的檔案由定期清理移除
+class TempPartHandler : public Poco::Net::PartHandler
+{
+public:
+    explicit TempPartHandler(const std::string& tempPath)
+        : mTempPath(tempPath)
+    {
+    }
+
+    void handlePart(const Poco::Net::MessageHeader& header, std::istream& stream) override
+    {
+        // 只處理檔案，一般欄位由 HTMLForm 處理
+        if (!header.has("Content-Disposition"))
+            return;
+
+        std::string disposition;
+        Poco::Net::NameValueCollection params;
+        Poco::Net::MessageHeader::splitParameters(header["Content-Disposition"], disposition, params);
+        if (!params.has("filename"))
+            return;
+
+        const std::string filename = Poco::TemporaryFile::tempName(mTempPath);
+        mFilenames.push_back(filename);
+        Poco::FileOutputStream ostr(filename);
+        Poco::StreamCopier::copyStream(stream, ostr);
+    }
+
+    bool empty() const { return mFilenames.empty(); }
+
+    /// @brief 第一個上傳檔案的路徑，沒有時傳回空字串
+    std::string getFilename() const
+    {
+        return mFilenames.empty() ? std::string() : mFilenames.front();
+    }
+
+    void removeFiles()
+    {
+        for (const auto& filename : mFilenames)
+        {
+            try
+            {
+                Poco::File(filename).remove();
+            }
+            catch (const Poco::Exception&)
+            {
+                // 檔案已不存在
+            }
+        }
+        mFilenames.clear();
+    }
+
+private:
+    const std::string mTempPath;
+    std::vector<std::string> mFilenames;
+};
+
+/// @brief 單一 request 的內容，由 handleRequest() 建立，交給權限檢查及各 API 共用
+///        form、query 及 JSON 都在第一次使用時才解析，而且只解析一次
+class RequestContext
+{
+public:
+    RequestContext(const Poco::Net::HTTPRequest& request,
+                   const std::shared_ptr<StreamSocket>& socket,
+                   const std::string& tempPath)
+        : mRequest(request)
+        , mSocket(socket)
+        , mPartHandler(tempPath)
+    {
+    }
+
+    RequestContext(const RequestContext&) = delete;
+    RequestContext& operator=(const RequestContext&) = delete;
+
+    ~RequestContext()
+    {
+        // 不論 API 是否正常結束，都移除收到的上傳檔案
+        if (mForm)
+            mPartHandler.removeFiles();
+    }
+
+    const Poco::Net::HTTPRequest& request() const { return mRequest; }
+
+    const std::shared_ptr<StreamSocket>& socket() const { return mSocket; }
+
+    /// @brief 取得 HTML Form(含上傳檔案)
+    const Poco::Net::HTMLForm& form()
+    {
+        if (!mForm)
+        {
+            Poco::MemoryInputStream message(&mSocket->getInBuffer()[0],
+                                            mSocket->getInBuffer().size());
+            mForm = std::make_unique<Poco::Net::HTMLForm>(mRequest, message, mPartHandler);
+        }
+        return *mForm;
+    }
+
+    /// @brief 取得 form 欄位值，沒有該欄位時傳回空字串
+    ///        傳回值指向 form 內部的資料，有效期間與本物件相同
+    std::string_view get(const std::string& name)
+    {
+        static const std::string empty;
+        return form().get(name, empty);
+    }
+
+    /// @brief 是否有收到上傳檔案
+    bool hasFile()
+    {
+        form();
+        return !mPartHandler.empty();
+    }
+
+    /// @brief 收到的上傳檔案路徑
+    std::string getFilename()
+    {
+        form();
+        return mPartHandler.getFilename();
+    }
+
+    /// @brief 取得 URI query 參數值，沒有該參數時傳回空字串
+    std::string_view query(const std::string& name)
+    {
+        for (const auto& param : queryParameters())
+        {
+            if (param.first == name)
+                return param.second;
+        }
+        return std::string_view();
+    }
+
+    /// @brief 檢查 URI query 參數都是 API 認得的名稱，而且沒有重複
+    /// @return false - 有不認得或重複的參數
+    bool hasOnlyQuery(std::initializer_list<std::string_view> names)
+    {
+        std::set<std::string_view> seen;
+        for (const auto& param : queryParameters())
+        {
+            if (std::find(names.begin(), names.end(), param.first) == names.end()
+                || !seen.insert(param.first).second)
+                return false;
+        }
+        return true;
+    }
+
+    /// @brief 把 form 欄位當作 JSON 物件解析，欄位不存在時視爲 "{}"
+    ///        JSON 語法錯誤時拋出 Poco::Exception
+    Poco::JSON::Object::Ptr json(const std::string& name)
+    {
+        if (mJsonName != name)
+        {
+            Poco::JSON::Parser parser;
+            const std::string_view value = get(name);
+            auto result = parser.parse(value.empty() ? std::string("{}") : std::string(value));
+            mJson = result.extract<Poco::JSON::Object::Ptr>();
+            mJsonName = name;
+        }
+        return mJson;
+    }
+
+private:
+    const Poco::URI::QueryParameters& queryParameters()
+    {
+        if (!mQueryParsed)
+        {
+            mQuery = Poco::URI(mRequest.getURI()).getQueryParameters();
+            mQueryParsed = true;
+        }
+        return mQuery;
+    }
+
+    const Poco::Net::HTTPRequest& mRequest;
+    const std::shared_ptr<StreamSocket> mSocket;
+
+    TempPartHandler mPartHandler;
+    std::unique_ptr<Poco::Net::HTMLForm> mForm;
+
+    bool mQueryParsed = false;
+    Poco::URI::QueryParameters mQuery;
+
+    std::string mJsonName;
+    Poco::JSON::Object::Ptr mJson;
+};
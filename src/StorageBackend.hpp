@@ -0,0 +1,374 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/RecursiveDirectoryIterator.h>
+#include <Poco/Timestamp.h>
+
+/// @brief 可以直接讀取的本機檔案，物件存在期間，檔案不會被快取移除
+class LocalFile
+{
+public:
+    LocalFile() {}
+
+    explicit LocalFile(const std::string& path, const std::shared_ptr<void>& pin = nullptr)
+        : mPath(path)
+        , mPin(pin)
+    {
+    }
+
+    /// @brief 檔案路徑，檔案不存在時爲空字串
+    const std::string& path() const { return mPath; }
+
+    bool empty() const { return mPath.empty(); }
+
+private:
+    std::string mPath;
+    /// 快取項目的釘選，所有複本都釋放後，快取才能移除該檔案
+    std::shared_ptr<void> mPin;
+};
+
+/// @brief 範本檔案的存取介面，所有檔名都是相對於倉庫根目錄的路徑
+class StorageBackend
+{
+public:
+    virtual ~StorageBackend() {}
+
+    /// @brief 檔案是否存在
+    virtual bool exists(const std::string& name) = 0;
+
+    /// @brief 檔案大小，檔案不存在時傳回 0
+    virtual Poco::File::FileSize getSize(const std::string& name) = 0;
+
+    /// @brief 檔案的修改時間，檔案不存在時傳回 0
+    virtual Poco::Timestamp getLastModified(const std::string& name) = 0;
+
+    /// @brief 取得可以直接讀取的本機檔案，檔案不存在時傳回空的 LocalFile
+    ///        讀取完成前必須保留傳回的物件
+    virtual LocalFile getLocalFile(const std::string& name) = 0;
+
+    /// @brief 存入檔案，先寫暫存檔再改名，不會有寫到一半的檔案
+    virtual void store(const std::string& sourceFile, const std::string& name) = 0;
+
+    /// @brief 以 hard link 替檔案建立另一個檔名
+    virtual void link(const std::string& name, const std::string& newName) = 0;
+
+    /// @brief 刪除檔案，檔案不存在時不做任何事
+    virtual void remove(const std::string& name) = 0;
+
+    /// @brief 列出所有檔案(相對路徑)，包括尚未寫完的 .part 暫存檔
+    virtual std::vector<std::string> list() const = 0;
+};
+
+/// @brief 直接存取本機(或掛載的)目錄
+class LocalStorage : public StorageBackend
+{
+public:
+    explicit LocalStorage(const std::string& root)
+        : mRoot(Poco::Path::forDirectory(root).toString())
+    {
+        Poco::File(mRoot).createDirectories();
+    }
+
+    /// @brief 根目錄(以 '/' 結尾)
+    const std::string& getRoot() const { return mRoot; }
+
+    /// @brief 檔案的完整路徑
+    std::string getPath(const std::string& name) const { return mRoot + name; }
+
+    bool exists(const std::string& name) override
+    {
+        return Poco::File(getPath(name)).exists();
+    }
+
+    Poco::File::FileSize getSize(const std::string& name) override
+    {
+        const Poco::File file(getPath(name));
+        return file.exists() ? file.getSize() : 0;
+    }
+
+    Poco::Timestamp getLastModified(const std::string& name) override
+    {
+        const Poco::File file(getPath(name));
+        return file.exists() ? file.getLastModified() : Poco::Timestamp(0);
+    }
+
+    LocalFile getLocalFile(const std::string& name) override
+    {
+        const std::string path = getPath(name);
+        return Poco::File(path).exists() ? LocalFile(path) : LocalFile();
+    }
+
+    void store(const std::string& sourceFile, const std::string& name) override
+    {
+        static std::atomic<unsigned long> sequence(0);
+
+        const std::string path = getPath(name);
+        // 同一個檔案可能同時寫入(例如快取)，暫存檔名不能重複
+        const std::string partFile = path + "." + std::to_string(++sequence) + ".part";
+        Poco::File(Poco::Path(path).parent()).createDirectories();
+        Poco::File(sourceFile).copyTo(partFile);
+        Poco::File(partFile).renameTo(path);
+    }
+
+    void link(const std::string& name, const std::string& newName) override
+    {
+        const std::string path = getPath(newName);
+        Poco::File(Poco::Path(path).parent()).createDirectories();
+        Poco::File(getPath(name)).linkTo(path, Poco::File::LINK_HARD);
+    }
+
+    void remove(const std::string& name) override
+    {
+        Poco::File file(getPath(name));
+        if (file.exists())
+            file.remove();
+    }
+
+    std::vector<std::string> list() const override
+    {
+        std::vector<std::string> names;
+        for (Poco::SimpleRecursiveDirectoryIterator it(mRoot), end; it != end; ++it)
+        {
+            if (it->isFile())
+                names.push_back(it.path().toString().substr(mRoot.size()));
+        }
+        return names;
+    }
+
+    /// @brief 清除上次中斷時，尚未寫完的暫存檔
+    void removePartFiles()
+    {
+        for (const auto& name : list())
+        {
+            if (Poco::Path(name).getExtension() == "part")
+                remove(name);
+        }
+    }
+
+private:
+    const std::string mRoot;
+};
+
+/// @brief 兩層式儲存：正本放在較慢的共用儲存區(例如 NFS)，
+///        讀取時在本機快速磁碟保留一份有容量上限的快取
+///        快取檔案的修改時間設成與正本相同，讀取時比對大小及修改時間，不一致就重新複製
+///        正在讀取的快取檔案(傳回的 LocalFile 尚未釋放)不會被移除
+class TieredStorage : public StorageBackend
+{
+public:
+    TieredStorage(const std::string& backingRoot, const std::string& cacheRoot,
+                  const Poco::File::FileSize maxCacheBytes)
+        : mBacking(backingRoot)
+        , mCache(cacheRoot)
+        , mMaxCacheBytes(maxCacheBytes)
+        , mCachedBytes(0)
+    {
+        mCache.removePartFiles();
+
+        // 載入既有的快取檔案
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const auto& name : mCache.list())
+        {
+            const Poco::File file(mCache.getPath(name));
+            addEntry(name, file.getSize(), file.getLastModified());
+        }
+        evict();
+    }
+
+    /// @brief 共用儲存區
+    LocalStorage& getBacking() { return mBacking; }
+
+    bool exists(const std::string& name) override
+    {
+        return mBacking.exists(name);
+    }
+
+    Poco::File::FileSize getSize(const std::string& name) override
+    {
+        return mBacking.getSize(name);
+    }
+
+    Poco::Timestamp getLastModified(const std::string& name) override
+    {
+        return mBacking.getLastModified(name);
+    }
+
+    LocalFile getLocalFile(const std::string& name) override
+    {
+        const std::string backingPath = mBacking.getPath(name);
+        Poco::File backingFile(backingPath);
+        if (!backingFile.exists())
+        {
+            dropEntry(name);
+            return LocalFile();
+        }
+
+        const Poco::File::FileSize size = backingFile.getSize();
+        const Poco::Timestamp modified = backingFile.getLastModified();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (auto it = mIndex.find(name); it != mIndex.end())
+            {
+                // 快取仍有效
+                if (it->second->size == size && it->second->modified == modified)
+                {
+                    mLru.splice(mLru.begin(), mLru, it->second);
+                    return LocalFile(mCache.getPath(name), it->second->pin);
+                }
+            }
+        }
+
+        // 檔案比整個快取還大，直接讀正本
+        if (size > mMaxCacheBytes)
+            return LocalFile(backingPath);
+
+        try
+        {
+            cacheFile(backingPath, name, size, modified);
+        }
+        catch (const Poco::Exception&)
+        {
+            // 快取失敗(例如本機磁碟已滿)，直接讀正本
+            return LocalFile(backingPath);
+        }
+
+        // 複製完成後可能已被移除(快取容量不足)，就讀正本
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (auto it = mIndex.find(name); it != mIndex.end())
+            return LocalFile(mCache.getPath(name), it->second->pin);
+        return LocalFile(backingPath);
+    }
+
+    void store(const std::string& sourceFile, const std::string& name) override
+    {
+        // 先寫入正本
+        mBacking.store(sourceFile, name);
+
+        // 同時寫入快取
+        const Poco::File backingFile(mBacking.getPath(name));
+        if (backingFile.getSize() <= mMaxCacheBytes)
+        {
+            try
+            {
+                cacheFile(sourceFile, name, backingFile.getSize(), backingFile.getLastModified());
+            }
+            catch (const Poco::Exception&)
+            {
+                // 只影響快取，下次讀取時再複製
+            }
+        }
+    }
+
+    void link(const std::string& name, const std::string& newName) override
+    {
+        // 新檔名第一次讀取時才放進快取
+        mBacking.link(name, newName);
+    }
+
+    void remove(const std::string& name) override
+    {
+        mBacking.remove(name);
+        dropEntry(name);
+    }
+
+    /// @brief 列出正本的檔案，快取只是複本
+    std::vector<std::string> list() const override
+    {
+        return mBacking.list();
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        Poco::File::FileSize size;
+        Poco::Timestamp modified; // 正本的修改時間
+        /// 傳回的 LocalFile 會共用這個物件，use_count() > 1 表示正在讀取
+        std::shared_ptr<void> pin;
+
+        bool pinned() const { return pin.use_count() > 1; }
+    };
+
+    /// @brief 複製一份到快取，並加入索引
+    void cacheFile(const std::string& sourceFile, const std::string& name,
+                   const Poco::File::FileSize size, const Poco::Timestamp& modified)
+    {
+        mCache.store(sourceFile, name);
+        Poco::File(mCache.getPath(name)).setLastModified(modified);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        addEntry(name, size, modified);
+        evict();
+    }
+
+    /// @brief 加入(或取代)索引中的項目，必須持有 mMutex
+    ///        取代時沿用原本的釘選，正在讀取的連線仍能保護檔案(內容相同，只是重新複製)
+    void addEntry(const std::string& name, const Poco::File::FileSize size,
+                  const Poco::Timestamp& modified)
+    {
+        std::shared_ptr<void> pin;
+        if (auto it = mIndex.find(name); it != mIndex.end())
+        {
+            pin = it->second->pin;
+            mCachedBytes -= it->second->size;
+            mLru.erase(it->second);
+        }
+        if (!pin)
+            pin = std::make_shared<char>(0);
+
+        mLru.push_front(Entry{name, size, modified, pin});
+        mIndex[name] = mLru.begin();
+        mCachedBytes += size;
+    }
+
+    /// @brief 移除最久未使用的快取，直到低於容量上限，必須持有 mMutex
+    ///        正在讀取的檔案略過，等下次再移除
+    void evict()
+    {
+        for (auto it = mLru.end(); mCachedBytes > mMaxCacheBytes && it != mLru.begin(); )
+        {
+            --it;
+            if (it->pinned())
+                continue;
+
+            mCache.remove(it->name);
+            mCachedBytes -= it->size;
+            mIndex.erase(it->name);
+            it = mLru.erase(it);
+        }
+    }
+
+    /// @brief 移除某個快取檔案，正在讀取時保留，下次讀取或清除時再處理
+    void dropEntry(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (auto it = mIndex.find(name); it != mIndex.end() && !it->second->pinned())
+        {
+            mCachedBytes -= it->second->size;
+            mLru.erase(it->second);
+            mIndex.erase(it);
+            mCache.remove(name);
+        }
+    }
+
+private:
+    LocalStorage mBacking;
+    LocalStorage mCache;
+    const Poco::File::FileSize mMaxCacheBytes;
+
+    std::mutex mMutex;
+    /// 快取項目，最近使用的在前面
+    std::list<Entry> mLru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> mIndex;
+    Poco::File::FileSize mCachedBytes;
+};
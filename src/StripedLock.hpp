@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/// @brief 依據 key 的雜湊值分配到固定數量的讀寫鎖
+///        不同 key 大多落在不同的鎖，可以同時進行；同一個 key 一定是同一把鎖
+///        每次只能鎖定一個 key，避免 deadlock
+class StripedLock
+{
+public:
+    explicit StripedLock(const std::size_t stripes = 64)
+        : mLocks(stripes)
+    {
+    }
+
+    StripedLock(const StripedLock&) = delete;
+    StripedLock& operator=(const StripedLock&) = delete;
+
+    /// @brief 取得 key 對應的鎖
+    std::shared_mutex& get(const std::string& key)
+    {
+        return mLocks[std::hash<std::string>()(key) % mLocks.size()];
+    }
+
+    /// @brief 寫入用，同一個 key 只允許一個
+    std::unique_lock<std::shared_mutex> lockWrite(const std::string& key)
+    {
+        return std::unique_lock<std::shared_mutex>(get(key));
+    }
+
+    /// @brief 讀取用，同一個 key 可多個同時讀取，但會等待寫入完成
+    std::shared_lock<std::shared_mutex> lockRead(const std::string& key)
+    {
+        return std::shared_lock<std::shared_mutex>(get(key));
+    }
+
+private:
+    std::vector<std::shared_mutex> mLocks;
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <Poco/DigestEngine.h>
+#include <Poco/Exception.h>
+#include <Poco/MD5Engine.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Tuple.h>
+#include <Poco/Data/RecordSet.h>
+#include <Poco/Data/Session.h>
+#include <Poco/Data/Statement.h>
+
+#include "StorageBackend.hpp"
+
+/// @brief 範本目錄：repository、retired 及 changelog 資料表，以及範本在倉庫內的檔名
+///        範本異動、舊版本停用及變更紀錄在同一個 transaction 中完成
+///        同一個 endpt 的寫入必須由呼叫端串行(StripedLock)，存入檔案後才更新目錄
+class TemplateCatalog
+{
+public:
+    // 更新資料庫行為
+    enum ActionType {ADD = 0, UPDATE, DELETE};
+    // 變更紀錄(changelog)中，各行為的名稱
+    static constexpr const char* ActionName[] = {"add", "update", "delete"};
+    // 更新資料庫的結果
+    enum UpdateResult {UPDATE_OK = 0, UPDATE_FAILED, UPDATE_QUOTA_EXCEEDED};
+
+    struct RepositoryStruct
+    {
+        unsigned long id    = 0;    // AUTOINCREMENT ID
+        std::string cname   = "";   // 範本資料夾名稱
+        std::string endpt   = "";   // 檔案代碼(存在 server 的檔名爲 endpt~version.extname)
+        std::string docname = "";   // 實際的檔名
+        std::string extname = "";   // 副檔名
+        std::string uptime  = "";   // 上傳時間(比較像是檔案最後修改時間)
+        std::string version = "";   // 檔案版本(空字串表示舊版未分版本的檔案)
+        unsigned long size  = 0;    // 檔案大小
+        std::string hash    = "";   // 檔案內容的 MD5
+        std::string prevfile   = ""; // 前一版本在倉庫內的檔名，用來產生差異檔
+        std::string prevhash   = ""; // 前一版本的 MD5
+        std::string prevuptime = ""; // 前一版本的上傳時間
+        unsigned long prevsize  = 0; // 前一版本的檔案大小
+        unsigned long deltasize = 0; // 差異檔大小(沒有差異檔時爲 0)
+    };
+
+    explicit TemplateCatalog(StorageBackend& storage)
+        : mStorage(storage)
+    {
+    }
+
+    /// @brief 建立資料表，舊版資料庫補上新增的欄位
+    static void createTables(Poco::Data::Session& session)
+    {
+        using namespace Poco::Data::Keywords;
+
+        session << "CREATE TABLE IF NOT EXISTS repository ("
+                << "id      INTEGER PRIMARY KEY AUTOINCREMENT,"
+                << "cname   TEXT NOT NULL DEFAULT '',"
+                << "endpt   TEXT NOT NULL DEFAULT '' UNIQUE,"   // end point 名稱
+                << "docname TEXT NOT NULL DEFAULT '',"          // 主檔名
+                << "extname TEXT NOT NULL DEFAULT '',"          // 副檔名
+                << "uptime  TEXT NOT NULL DEFAULT '')", now;    // 上傳日期
+        // 檔案版本，每次上傳都是新的檔案，更新時只切換資料表指向的版本
+        addColumnIfNotExists(session, "repository", "version", "TEXT NOT NULL DEFAULT ''");
+        // 檔案大小，計算倉庫用量
+        addColumnIfNotExists(session, "repository", "size", "INTEGER NOT NULL DEFAULT 0");
+        // 檔案內容的 MD5，client 以此判斷手上的版本
+        addColumnIfNotExists(session, "repository", "hash", "TEXT NOT NULL DEFAULT ''");
+        // 保留前一版本，client 持有前一版本時，只需下載差異檔
+        addColumnIfNotExists(session, "repository", "prevfile", "TEXT NOT NULL DEFAULT ''");
+        addColumnIfNotExists(session, "repository", "prevhash", "TEXT NOT NULL DEFAULT ''");
+        addColumnIfNotExists(session, "repository", "prevuptime", "TEXT NOT NULL DEFAULT ''");
+        // 前一版本及差異檔也佔用倉庫空間，計入用量
+        addColumnIfNotExists(session, "repository", "prevsize", "INTEGER NOT NULL DEFAULT 0");
+        addColumnIfNotExists(session, "repository", "deltasize", "INTEGER NOT NULL DEFAULT 0");
+
+        // 已被取代或刪除的版本檔案，保留一段時間，讓正在讀取的連線能完成
+        session << "CREATE TABLE IF NOT EXISTS retired ("
+                << "id      INTEGER PRIMARY KEY AUTOINCREMENT,"
+                << "file    TEXT NOT NULL DEFAULT '',"      // 倉庫內的檔名
+                << "retired INTEGER NOT NULL DEFAULT 0)", now; // 停用時間(epoch 秒數)
+
+        // 變更紀錄，只會新增不會修改，revision 即爲倉庫的版本編號
+        session << "CREATE TABLE IF NOT EXISTS changelog ("
+                << "revision INTEGER PRIMARY KEY AUTOINCREMENT,"
+                << "action   TEXT NOT NULL DEFAULT '',"  // add, update, delete
+                << "endpt    TEXT NOT NULL DEFAULT '',"
+                << "cname    TEXT NOT NULL DEFAULT '',"
+                << "docname  TEXT NOT NULL DEFAULT '',"
+                << "extname  TEXT NOT NULL DEFAULT '',"
+                << "uptime   TEXT NOT NULL DEFAULT '')", now;
+    }
+
+    /// @brief 取得符合 endpt 的紀錄，不存在時 id 爲 0
+    static RepositoryStruct get(Poco::Data::Session& session, const std::string& endpt)
+    {
+        using namespace Poco::Data::Keywords;
+
+        RepositoryStruct repo;
+        session << "SELECT id, cname, docname, endpt, extname, uptime, version, size, "
+                << "hash, prevfile, prevhash, prevuptime, prevsize, deltasize "
+                << "FROM repository WHERE endpt=?",
+            into(repo.id), into(repo.cname), into(repo.docname),
+            into(repo.endpt), into(repo.extname), into(repo.uptime),
+            into(repo.version), into(repo.size), into(repo.hash),
+            into(repo.prevfile), into(repo.prevhash), into(repo.prevuptime),
+            into(repo.prevsize), into(repo.deltasize), use(endpt), now;
+        return repo;
+    }
+
+    /// @brief 目前範本的總用量(bytes)，包含目前版本、前一版本及差異檔
+    static unsigned long getUsage(Poco::Data::Session& session)
+    {
+        using namespace Poco::Data::Keywords;
+
+        unsigned long usage = 0;
+        session << "SELECT IFNULL(SUM(size + prevsize + deltasize), 0) FROM repository", into(usage), now;
+        return usage;
+    }
+
+    /// @brief 更新範本資料表，被取代的版本改爲前一版本，用不到的檔案移到 retired
+    /// @param quotaBytes 倉庫容量上限，0 表示不限制
+    /// @param revision 成功時傳回這次異動的倉庫版本編號
+    /// @param previousCname 不是 nullptr 時，成功後傳回異動前的範本類別(新增時爲空字串)
+    /// @return UPDATE_QUOTA_EXCEEDED - 超過倉庫容量上限，資料表未變更
+    /// @exception Poco::Exception 資料庫錯誤，已 rollback
+    UpdateResult update(Poco::Data::Session& session, const ActionType type, RepositoryStruct& repo,
+                        const unsigned long quotaBytes, unsigned long& revision,
+                        std::string* previousCname = nullptr)
+    {
+        using namespace Poco::Data::Keywords;
+
+        bool inTransaction = false;
+        try
+        {
+            // 範本異動、舊版本停用與變更紀錄必須同時成功
+            // 先讀後寫，必須一開始就取得寫入鎖，否則其他連線在讀寫之間提交時，
+            // WAL 模式會傳回 SQLITE_BUSY_SNAPSHOT(不會等待重試)
+            session << "BEGIN IMMEDIATE", now;
+            inTransaction = true;
+
+            // 目前的版本，更新後改爲前一版本，刪除後就停用
+            RepositoryStruct current;
+            std::vector<std::string> retiredFiles;
+            if (type != ActionType::ADD)
+            {
+                session << "SELECT id, cname, endpt, extname, uptime, version, size, hash, prevfile, "
+                        << "prevsize, deltasize FROM repository WHERE endpt=?",
+                        into(current.id), into(current.cname), into(current.endpt),
+                        into(current.extname), into(current.uptime), into(current.version),
+                        into(current.size), into(current.hash), into(current.prevfile),
+                        into(current.prevsize), into(current.deltasize), use(repo.endpt), now;
+            }
+
+            if (current.id != 0
+                && (type == ActionType::DELETE || getTemplateFileName(current) != getTemplateFileName(repo)))
+            {
+                if (type == ActionType::UPDATE)
+                {
+                    repo.prevfile   = locateTemplateFile(current);
+                    repo.prevhash   = current.hash;
+                    repo.prevuptime = current.uptime;
+                    repo.prevsize   = current.size;
+                    // 新的差異檔在背景產生後才寫入大小
+                    repo.deltasize  = 0;
+                }
+                else
+                    retiredFiles.push_back(locateTemplateFile(current));
+
+                // 原本的前一版本及差異檔都用不到了(差異檔存入後才會記錄大小)
+                if (!current.prevfile.empty())
+                    retiredFiles.push_back(current.prevfile);
+                if (current.deltasize != 0)
+                    retiredFiles.push_back(getDeltaFileName(current));
+            }
+
+            // 容量檢查與寫入在同一個 transaction(已取得寫入鎖)，同時上傳也不會超過上限
+            // 用量包含目前版本、前一版本及差異檔
+            if (type != ActionType::DELETE && quotaBytes != 0
+                && getUsage(session) - (current.size + current.prevsize + current.deltasize)
+                    + repo.size + repo.prevsize + repo.deltasize > quotaBytes)
+            {
+                session << "ROLLBACK", now;
+                inTransaction = false;
+                return UpdateResult::UPDATE_QUOTA_EXCEEDED;
+            }
+
+            switch (type)
+            {
+                case ActionType::ADD: // 新增
+                    session << "INSERT INTO repository (endpt, extname, cname, docname, uptime, version, size, hash) "
+                            << "VALUES(?, ?, ?, ?, ?, ?, ?, ?)",
+                            use(repo.endpt), use(repo.extname),
+                            use(repo.cname), use(repo.docname),
+                            use(repo.uptime), use(repo.version), use(repo.size), use(repo.hash), now;
+                    break;
+
+                case ActionType::UPDATE: // 更新(切換到新版本)
+                    session << "UPDATE repository SET extname=?, cname=?, docname=?, uptime=?, version=?, size=?, "
+                            << "hash=?, prevfile=?, prevhash=?, prevuptime=?, prevsize=?, deltasize=? "
+                            << "WHERE endpt=?",
+                            use(repo.extname), use(repo.cname), use(repo.docname),
+                            use(repo.uptime), use(repo.version), use(repo.size),
+                            use(repo.hash), use(repo.prevfile), use(repo.prevhash),
+                            use(repo.prevuptime), use(repo.prevsize), use(repo.deltasize),
+                            use(repo.endpt), now;
+                    break;
+
+                case ActionType::DELETE: // 刪除
+                    session << "DELETE FROM repository WHERE endpt=?", use(repo.endpt), now;
+                    break;
+            }
+
+            // 停用舊版本檔案
+            unsigned long retiredTime = Poco::Timestamp().epochTime();
+            for (auto& retiredFile : retiredFiles)
+            {
+                session << "INSERT INTO retired (file, retired) VALUES(?, ?)",
+                        use(retiredFile), use(retiredTime), now;
+            }
+
+            // 寫入變更紀錄
+            std::string action = ActionName[type];
+            session << "INSERT INTO changelog (action, endpt, cname, docname, extname, uptime) "
+                    << "VALUES(?, ?, ?, ?, ?, ?)",
+                    use(action), use(repo.endpt), use(repo.cname),
+                    use(repo.docname), use(repo.extname), use(repo.uptime), now;
+
+            session << "SELECT last_insert_rowid()", into(revision), now;
+            session << "COMMIT", now;
+            inTransaction = false;
+
+            if (previousCname)
+                *previousCname = current.cname;
+        }
+        catch (const Poco::Exception&)
+        {
+            if (inTransaction)
+            {
+                try
+                {
+                    session << "ROLLBACK", now;
+                }
+                catch (const Poco::Exception&)
+                {
+                    // 連線異常時 SQLite 已自動 rollback
+                }
+            }
+            throw;
+        }
+
+        return UpdateResult::UPDATE_OK;
+    }
+
+    /// @brief 刪除在 retiredBefore(epoch 秒數)之前停用的版本檔案
+    /// @param reclaimedBytes 累加刪除的檔案大小
+    /// @param reclaimedFiles 累加刪除的檔案數
+    void collectRetired(Poco::Data::Session& session, const unsigned long retiredBefore,
+                        unsigned long& reclaimedBytes, unsigned long& reclaimedFiles)
+    {
+        using namespace Poco::Data::Keywords;
+
+        std::vector<Poco::Tuple<unsigned long, std::string>> records;
+        unsigned long expired = retiredBefore;
+        session << "SELECT id, file FROM retired WHERE retired<=?",
+                use(expired), into(records), now;
+
+        for (auto& record : records)
+        {
+            const unsigned long size = mStorage.getSize(record.get<1>());
+            if (mStorage.exists(record.get<1>()))
+            {
+                mStorage.remove(record.get<1>());
+                reclaimedBytes += size;
+                ++reclaimedFiles;
+            }
+
+            session << "DELETE FROM retired WHERE id=?", use(record.get<0>()), now;
+        }
+    }
+
+    /// @brief 範本在倉庫內的檔名，有版本時爲 endpt~version.extname
+    static std::string getTemplateFileName(const RepositoryStruct& repo)
+    {
+        return repo.endpt + (repo.version.empty() ? "" : "~" + repo.version) + "." + repo.extname;
+    }
+
+    /// @brief 依據 endpt 的雜湊值分成兩層目錄，避免單一目錄檔案過多，例如 "3f/a2"
+    static std::string getShardPath(const std::string& endpt)
+    {
+        Poco::MD5Engine md5;
+        md5.update(endpt);
+        const std::string hex = Poco::DigestEngine::digestToHex(md5.digest());
+        return hex.substr(0, 2) + "/" + hex.substr(2, 2);
+    }
+
+    /// @brief 範本在倉庫內分層目錄的相對路徑
+    static std::string getShardedFileName(const RepositoryStruct& repo)
+    {
+        return getShardPath(repo.endpt) + "/" + getTemplateFileName(repo);
+    }
+
+    /// @brief 從前一版本到此版本的差異檔，在倉庫內的相對路徑
+    static std::string getDeltaFileName(const RepositoryStruct& repo)
+    {
+        return getShardedFileName(repo) + ".delta";
+    }
+
+    /// @brief 範本檔案目前在倉庫內的相對路徑，尚未搬到分層目錄的舊檔案，傳回原本的位置
+    std::string locateTemplateFile(const RepositoryStruct& repo)
+    {
+        const std::string shardedName = getShardedFileName(repo);
+        if (mStorage.exists(shardedName))
+            return shardedName;
+
+        const std::string flatName = getTemplateFileName(repo);
+        if (mStorage.exists(flatName))
+            return flatName;
+
+        return shardedName;
+    }
+
+private:
+    /// @brief 資料表缺少欄位時補上(舊版資料庫升級用)
+    static void addColumnIfNotExists(Poco::Data::Session& session, const std::string& table,
+                                     const std::string& column, const std::string& definition)
+    {
+        using namespace Poco::Data::Keywords;
+
+        Poco::Data::Statement select(session);
+        select << "PRAGMA table_info(" + table + ")", now;
+        Poco::Data::RecordSet rs(select);
+        for (auto row : rs)
+        {
+            if (row["name"].convert<std::string>() == column)
+                return;
+        }
+
+        session << "ALTER TABLE " + table + " ADD COLUMN " + column + " " + definition, now;
+    }
+
+private:
+    StorageBackend& mStorage;
+};
@@ -1,8 +1,19 @@
-
+#include "config.h"
 
 #include <sys/stat.h>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
 #include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
 
 #include <OxOOL/Module/Base.h>
 #include <OxOOL/HttpHelper.h>
@@ -10,10 +21,13 @@
 #include <common/Log.hpp>
 #include <net/Socket.hpp>
 
-#include <Poco/MemoryStream.h>
+#include <Poco/DateTime.h>
+#include <Poco/DigestEngine.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/MD5Engine.h>
+#include <Poco/RecursiveDirectoryIterator.h>
 #include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPResponse.h>
-#include <Poco/Net/HTMLForm.h>
 #include <Poco/Data/SessionPool.h>
 #include <Poco/Data/Session.h>
 #include <Poco/Data/RecordSet.h>
@@ -21,7 +35,19 @@
 #include <Poco/JSON/Parser.h>
 #include <Poco/Zip/Compress.h>
 #include <Poco/URI.h>
+#include <Poco/String.h>
+#include <Poco/StringTokenizer.h>
 #include <Poco/TemporaryFile.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Util/XMLConfiguration.h>
+
+#include "BinaryDelta.hpp"
+#include "ContentEncoding.hpp"
+#include "HotTemplateCache.hpp"
+#include "RequestContext.hpp"
+#include "StorageBackend.hpp"
+#include "StripedLock.hpp"
+#include "TemplateCatalog.hpp"
 
 using namespace Poco::Data::Keywords;
 
@@ -43,24 +69,29 @@ public:
         // 檢查類別
         CheckType check;
         // callback method
-        std::function<void(const Poco::Net::HTTPRequest& request,
-            const std::shared_ptr<StreamSocket>& socket)> function;
+        std::function<void(RequestContext& context)> function;
     };
 
-    // 更新資料庫行為
-    enum ActionType {ADD = 0, UPDATE, DELETE};
-
-    struct RepositoryStruct
-    {
-        unsigned long id    = 0;    // AUTOINCREMENT ID
-        std::string cname   = "";   // 範本資料夾名稱
-        std::string endpt   = "";   // 檔案代碼(存在 server 的檔名爲 endpt + "." + extname)
-        std::string docname = "";   // 實際的檔名
-        std::string extname = "";   // 副檔名
-        std::string uptime  = "";   // 上傳時間(比較像是檔案最後修改時間)
-    };
+    // 範本資料表及更新結果，定義在 TemplateCatalog
+    using ActionType = TemplateCatalog::ActionType;
+    using UpdateResult = TemplateCatalog::UpdateResult;
+    using RepositoryStruct = TemplateCatalog::RepositoryStruct;
 
     TemplateRepo()
+        : mRevision(0)
+        , mMaintenanceStop(false)
+        , mDeltaStop(false)
+        , mQuotaBytes(0)
+        , mReclaimedBytes(0)
+        , mReclaimedFiles(0)
+        , mLastMaintenance(0)
+        , mBundleStop(false)
+        , mMigrationRunning(false)
+        , mMigrationStop(false)
+        , mMigrated(0)
+        , mMigrationTotal(0)
+        , mResponseCacheBytes(0)
+        , mWatchStop(false)
     {
         // 註冊 SQLite 連結
         Poco::Data::SQLite::Connector::registerConnector();
@@ -70,18 +101,108 @@ public:
 
     ~TemplateRepo()
     {
+        // 停止等待範本異動的執行緒
+        {
+            std::lock_guard<std::mutex> lock(mWatchMutex);
+            mWatchStop = true;
+        }
+        mWatchCond.notify_all();
+        if (mWatchThread.joinable())
+            mWatchThread.join();
+        if (mWatchPoll)
+            mWatchPoll->joinThread();
+
+        // 停止背景維護工作
+        {
+            std::lock_guard<std::mutex> lock(mMaintenanceMutex);
+            mMaintenanceStop = true;
+        }
+        mMaintenanceCond.notify_all();
+        if (mMaintenanceThread.joinable())
+            mMaintenanceThread.join();
+
+        // 停止重建群組壓縮檔
+        {
+            std::lock_guard<std::mutex> lock(mBundleMutex);
+            mBundleStop = true;
+        }
+        mBundleCond.notify_all();
+        if (mBundleThread.joinable())
+            mBundleThread.join();
+
+        // 停止產生差異檔
+        {
+            std::lock_guard<std::mutex> lock(mDeltaMutex);
+            mDeltaStop = true;
+        }
+        mDeltaCond.notify_all();
+        if (mDeltaThread.joinable())
+            mDeltaThread.join();
+
+        // 停止搬移倉庫檔案
+        mMigrationStop = true;
+        if (mMigrationThread.joinable())
+            mMigrationThread.join();
+
         Poco::Data::SQLite::Connector::unregisterConnector();
     }
 
     void initialize() override
     {
-        // 範本存放路徑
-        const std::string repositoryPath = getRepositoryPath();
-        // 路徑不存在就建立
-        if (!Poco::File(repositoryPath).exists())
-            Poco::File(repositoryPath).createDirectories();
+        // 讀取模組配置檔
+        mConfig = new Poco::Util::XMLConfiguration();
+        try
+        {
+            mConfig->load(MODULE_CONFIG_FILE);
+        }
+        catch (const Poco::Exception& exc)
+        {
+            LOG_WRN("Admin module [" << getDetail().name << "] load config:" << exc.displayText());
+            mConfig->loadEmpty("config");
+        }
+
+        // 範本存放路徑，未指定時放在模組資料目錄下
+        std::string repositoryPath = mConfig->getString("storage.path", "");
+        if (repositoryPath.empty())
+            repositoryPath = getDocumentRoot() + "/repository";
+
+        // 正本在共用儲存區時，在本機加一層快取
+        if (mConfig->getBool("storage.cache[@enable]", false))
+        {
+            mStorage = std::make_unique<TieredStorage>(repositoryPath,
+                mConfig->getString("storage.cache.path"),
+                static_cast<Poco::File::FileSize>(mConfig->getUInt("storage.cache.maxSize", 1024))
+                    * 1024 * 1024);
+        }
+        else
+        {
+            auto storage = std::make_unique<LocalStorage>(repositoryPath);
+            // 清除上次中斷時，尚未寫完的檔案(共用儲存區可能有其他主機正在寫入，不能清除)
+            storage->removePartFiles();
+            mStorage = std::move(storage);
+        }
+        mCatalog = std::make_unique<TemplateCatalog>(*mStorage);
+
+        // 常用範本放在記憶體的容量上限(MB)，0 表示不使用
+        mHotCache = std::make_unique<HotTemplateCache>(
+            static_cast<std::size_t>(mConfig->getUInt("storage.memoryCache.maxSize", 64)) * 1024 * 1024);
+
+        // 倉庫容量上限(MB)，0 表示不限制
+        mQuotaBytes = static_cast<unsigned long>(mConfig->getUInt("storage.quota", 0)) * 1024 * 1024;
+
+        // 模組專用的暫存目錄，由背景維護工作清除過期的檔案
+        Poco::File(getTempPath()).createDirectories();
+
+        // 群組壓縮檔，上次執行留下的可能已過期，第一次需要時再重建
+        Poco::File bundlePath(getBundlePath());
+        if (bundlePath.exists())
+            bundlePath.remove(true);
+        bundlePath.createDirectories();
 
         auto session = getDataSession();
+        // 讀取不會被寫入阻擋
+        std::string journalMode;
+        session << "PRAGMA journal_mode=WAL", into(journalMode), now;
 
         session << "CREATE TABLE IF NOT EXISTS maciplist ("
                 << "id          INTEGER PRIMARY KEY AUTOINCREMENT,"
@@ -90,13 +211,25 @@ public:
                 << "description TEXT NOT NULL DEFAULT '');"
                 << "CREATE UNIQUE INDEX IF NOT EXISTS macip on maciplist(macip);", now;
 
-        session << "CREATE TABLE IF NOT EXISTS repository ("
-                << "id      INTEGER PRIMARY KEY AUTOINCREMENT,"
-                << "cname   TEXT NOT NULL DEFAULT '',"
-                << "endpt   TEXT NOT NULL DEFAULT '' UNIQUE,"   // end point 名稱
-                << "docname TEXT NOT NULL DEFAULT '',"          // 主檔名
-                << "extname TEXT NOT NULL DEFAULT '',"          // 副檔名
-                << "uptime  TEXT NOT NULL DEFAULT '')", now;    // 上傳日期
+        // 範本、停用版本及變更紀錄
+        TemplateCatalog::createTables(session);
+
+        // 取得目前倉庫版本編號
+        unsigned long revision = 0;
+        session << "SELECT IFNULL(MAX(revision), 0) FROM changelog", into(revision), now;
+        mRevision = revision;
+
+        // 等待中的 /watch 連線都交給這個 poll，回應只在它的執行緒送出
+        mWatchPoll = std::make_unique<SocketPoll>("templaterepo_watch");
+        mWatchPoll->startThread();
+        // 計算哪些連線可以回應(有異動或逾時)，不直接存取連線
+        mWatchThread = std::thread(&TemplateRepo::watchLoop, this);
+        // 背景維護工作
+        mMaintenanceThread = std::thread(&TemplateRepo::maintenanceLoop, this);
+        // 範本更新後，產生前一版本到新版本的差異檔
+        mDeltaThread = std::thread(&TemplateRepo::deltaLoop, this);
+        // 範本異動後，重建該群組的壓縮檔
+        mBundleThread = std::thread(&TemplateRepo::bundleLoop, this);
     }
 
     void handleRequest(const Poco::Net::HTTPRequest& request,
@@ -107,7 +240,7 @@ public:
         // 是否支援此 API
         if (auto it = mApiMap.find(requestAPI); it != mApiMap.end())
         {
-            auto api = it->second;
+            const API& api = it->second;
             // 1. 先檢查 request 方法是否正確?
             if (request.getMethod() != api.method)
             {
@@ -118,6 +251,9 @@ public:
                 return;
             }
 
+            // request 內容只解析一次，權限檢查及 API 共用，上傳檔案存在模組暫存目錄
+            RequestContext context(request, socket, getTempPath());
+
             // 2. 是否要檢查 IP or MAC address?
             switch (api.check)
             {
@@ -135,8 +271,7 @@ public:
                 case CheckType::MAC:
                     // do check mac address
                     // Mac address 是放在 client 端的 form 中
-                    // 讀取 HTTML Form.
-                    if (!allowedMAC(request, socket))
+                    if (!allowedMAC(context))
                     {
                         OxOOL::HttpHelper::sendErrorAndShutdown(
                             Poco::Net::HTTPResponse::HTTP_FORBIDDEN,
@@ -150,7 +285,7 @@ public:
                     break;
             }
 
-            api.function(request, socket); // 執行對應的 API
+            api.function(context); // 執行對應的 API
         }
         else // 沒有相對應的 API 就回應 NOT FOUND
         {
@@ -261,6 +396,34 @@ public:
             }
 
         }
+        // 把倉庫內的檔案搬到分層目錄，搬移期間仍可正常服務
+        else if (tokens.equals(0, "migrateRepository"))
+        {
+            bool expected = false;
+            if (mMigrationRunning.compare_exchange_strong(expected, true))
+            {
+                if (mMigrationThread.joinable())
+                    mMigrationThread.join();
+
+                mMigrationThread = std::thread(&TemplateRepo::migrateRepository, this);
+            }
+            return getMigrationStatus();
+        }
+        // 取得搬移進度
+        else if (tokens.equals(0, "getMigrationStatus"))
+        {
+            return getMigrationStatus();
+        }
+        // 取得倉庫用量及背景維護結果
+        else if (tokens.equals(0, "getMaintenanceStatus"))
+        {
+            return getMaintenanceStatus();
+        }
+        // 取得記憶體快取統計
+        else if (tokens.equals(0, "getCacheStatus"))
+        {
+            return getCacheStatus();
+        }
         // 刪除來源
         else if (tokens.equals(0, "deleteSource") && tokens.size() == 2)
         {
@@ -284,6 +447,100 @@ public:
 private:
     std::map<std::string, API> mApiMap;
 
+    /// 模組配置
+    Poco::AutoPtr<Poco::Util::XMLConfiguration> mConfig;
+
+    /// 範本檔案存取
+    std::unique_ptr<StorageBackend> mStorage;
+    /// 範本資料表及倉庫內的檔名
+    std::unique_ptr<TemplateCatalog> mCatalog;
+
+    /// 依 endpt 分配的讀寫鎖，同一個範本的檔案及資料表異動不會同時進行
+    StripedLock mEndptLocks;
+
+    /// 常用範本的記憶體快取
+    std::unique_ptr<HotTemplateCache> mHotCache;
+
+    /// 倉庫版本編號，每次異動範本資料都會遞增
+    std::atomic<unsigned long> mRevision;
+
+    /// 背景維護工作
+    std::thread mMaintenanceThread;
+    std::mutex mMaintenanceMutex;
+    std::condition_variable mMaintenanceCond;
+    bool mMaintenanceStop;
+
+    /// 背景產生差異檔，/update 不必等待
+    std::thread mDeltaThread;
+    std::mutex mDeltaMutex;
+    std::condition_variable mDeltaCond;
+    bool mDeltaStop;
+    /// 等待產生差異檔的範本(endpt)
+    std::set<std::string> mPendingDeltas;
+
+    /// 倉庫容量上限(bytes)，0 表示不限制
+    unsigned long mQuotaBytes;
+    /// 背景維護累計清除的檔案
+    std::atomic<unsigned long> mReclaimedBytes;
+    std::atomic<unsigned long> mReclaimedFiles;
+    /// 最後一次背景維護的時間(epoch 秒數)
+    std::atomic<unsigned long> mLastMaintenance;
+
+    /// 各群組(cname)預先壓縮好的 zip 檔，只有該群組的範本異動時才重建
+    std::thread mBundleThread;
+    std::mutex mBundleMutex;
+    std::condition_variable mBundleCond;
+    bool mBundleStop;
+    /// 需要重建的群組
+    std::set<std::string> mDirtyGroups;
+    /// 各群組目前壓縮檔建立時的倉庫版本，當作 ETag，新的壓縮檔就位後才更換
+    std::map<std::string, unsigned long> mBundleRevisions;
+    /// 已確認沒有範本的群組，直接回應 404，不必每次查詢資料表
+    std::set<std::string> mEmptyGroups;
+    /// 同時只重建一個群組
+    std::mutex mBundleBuildMutex;
+
+    /// 搬移到分層目錄的執行緒及進度
+    std::thread mMigrationThread;
+    std::atomic<bool> mMigrationRunning;
+    std::atomic<bool> mMigrationStop;
+    std::atomic<unsigned long> mMigrated;
+    std::atomic<unsigned long> mMigrationTotal;
+
+    /// 文字回應的快取，同一組查詢條件在同一個倉庫版本內，回應內容及壓縮結果只產生一次
+    struct CachedResponse
+    {
+        std::string key; // 由整理過的查詢參數組成
+        unsigned long revision; // 產生時的倉庫版本
+        std::string mimeType;
+        std::vector<std::pair<std::string, std::string>> headers;
+        /// 依壓縮方式索引，IDENTITY 爲原始內容，其他方式在第一次需要時才壓縮
+        /// 壓縮後沒有比較小時，指向原始內容
+        std::array<std::shared_ptr<const std::string>, ContentEncoding::COUNT> bodies;
+        /// 計入快取用量的大小(bytes)
+        std::size_t bytes = 0;
+    };
+    /// 依最近使用排序，最前面是最近使用的，用量超過 MaxCachedResponseBytes 時從最後面清除
+    std::list<std::shared_ptr<CachedResponse>> mResponseCacheOrder;
+    std::map<std::string, std::list<std::shared_ptr<CachedResponse>>::iterator> mResponseCache;
+    std::size_t mResponseCacheBytes;
+    std::mutex mResponseCacheMutex;
+
+    /// 等待範本異動的連線
+    struct Watcher
+    {
+        unsigned long since; // client 已知的版本
+        std::weak_ptr<StreamSocket> socket;
+    };
+    /// 依逾時時間排序的等待連線
+    std::multimap<std::chrono::steady_clock::time_point, Watcher> mWatchers;
+    std::mutex mWatchMutex;
+    std::condition_variable mWatchCond;
+    std::thread mWatchThread;
+    bool mWatchStop;
+    /// 擁有等待中連線的 poll，連線的讀寫都在它的執行緒進行
+    std::unique_ptr<SocketPoll> mWatchPoll;
+
     /// @brief 檢查 IP 來源是否允許
     /// @param socket
     /// @return true - 允許
@@ -307,14 +564,9 @@ private:
         return allowed;
     }
 
-    bool allowedMAC(const Poco::Net::HTTPRequest& request,
-                    const std::shared_ptr<StreamSocket>& socket)
+    bool allowedMAC(RequestContext& context)
     {
-        // 讀取 HTTML Form.
-        Poco::MemoryInputStream message(&socket->getInBuffer()[0],
-                                        socket->getInBuffer().size());
-        const Poco::Net::HTMLForm form(request, message);
-        std::string macAddress = form.get("mac_addr", "");
+        std::string macAddress(context.get("mac_addr"));
 
         if (macAddress.empty())
             return false;
@@ -341,8 +593,7 @@ private:
                 {
                     method: Poco::Net::HTTPRequest::HTTP_GET,
                     check: CheckType::IP,
-                    function: std::bind(&TemplateRepo::yamlAPI, this,
-                        std::placeholders::_1, std::placeholders::_2)
+                    function: std::bind(&TemplateRepo::yamlAPI, this, std::placeholders::_1)
                 }
             }, */
             {
@@ -350,8 +601,23 @@ private:
                 {
                     method: Poco::Net::HTTPRequest::HTTP_GET,
                     check: CheckType::NONE,
-                    function: std::bind(&TemplateRepo::listAPI, this,
-                        std::placeholders::_1, std::placeholders::_2)
+                    function: std::bind(&TemplateRepo::listAPI, this, std::placeholders::_1)
+                }
+            },
+            {
+                "/changes",
+                {
+                    method: Poco::Net::HTTPRequest::HTTP_GET,
+                    check: CheckType::NONE,
+                    function: std::bind(&TemplateRepo::changesAPI, this, std::placeholders::_1)
+                }
+            },
+            {
+                "/watch",
+                {
+                    method: Poco::Net::HTTPRequest::HTTP_GET,
+                    check: CheckType::NONE,
+                    function: std::bind(&TemplateRepo::watchAPI, this, std::placeholders::_1)
                 }
             },
             {
@@ -359,8 +625,15 @@ private:
                 {
                     method: Poco::Net::HTTPRequest::HTTP_POST,
                     check: CheckType::MAC,
-                    function: std::bind(&TemplateRepo::syncAPI, this,
-                        std::placeholders::_1, std::placeholders::_2)
+                    function: std::bind(&TemplateRepo::syncAPI, this, std::placeholders::_1)
+                }
+            },
+            {
+                "/syncgroup",
+                {
+                    method: Poco::Net::HTTPRequest::HTTP_POST,
+                    check: CheckType::MAC,
+                    function: std::bind(&TemplateRepo::syncGroupAPI, this, std::placeholders::_1)
                 }
             },
             {
@@ -368,8 +641,7 @@ private:
                 {
                     method: Poco::Net::HTTPRequest::HTTP_POST,
                     check: CheckType::IP,
-                    function: std::bind(&TemplateRepo::uploadAPI, this,
-                        std::placeholders::_1, std::placeholders::_2)
+                    function: std::bind(&TemplateRepo::uploadAPI, this, std::placeholders::_1)
                 }
             },
             {
@@ -377,8 +649,7 @@ private:
                 {
                     method: Poco::Net::HTTPRequest::HTTP_POST,
                     check: CheckType::IP,
-                    function: std::bind(&TemplateRepo::updateAPI, this,
-                        std::placeholders::_1, std::placeholders::_2)
+                    function: std::bind(&TemplateRepo::updateAPI, this, std::placeholders::_1)
                 }
             },
             {
@@ -386,8 +657,7 @@ private:
                 {
                     method: Poco::Net::HTTPRequest::HTTP_POST,
                     check: CheckType::IP,
-                    function: std::bind(&TemplateRepo::deleteAPI, this,
-                        std::placeholders::_1, std::placeholders::_2)
+                    function: std::bind(&TemplateRepo::deleteAPI, this, std::placeholders::_1)
                 }
             },
             {
@@ -395,8 +665,7 @@ private:
                 {
                     method: Poco::Net::HTTPRequest::HTTP_POST,
                     check: CheckType::MAC,
-                    function: std::bind(&TemplateRepo::downloadAPI, this,
-                        std::placeholders::_1, std::placeholders::_2)
+                    function: std::bind(&TemplateRepo::downloadAPI, this, std::placeholders::_1)
                 }
             }
         };
@@ -487,70 +756,475 @@ private:
             Poco::Net::HTTPResponse::HTTP_OK, "text/yaml; charset=utf-8");
     } */
 
-    void listAPI(const Poco::Net::HTTPRequest& /*request*/,
-                 const std::shared_ptr<StreamSocket>& socket)
+    /// @brief 範本列表，未指定參數時，傳回依範本類別分組的完整列表
+    ///        可用的 query 參數:
+    ///        cname=a,b      只列出指定的範本類別
+    ///        fields=a,b     只傳回指定欄位(docname, endpt, extname, uptime)
+    ///        cursor=N       分頁，從上一頁回應的 X-Next-Cursor 繼續
+    ///        limit=N        分頁，每頁筆數
+    ///        format=json    依類別分組的 JSON(預設)
+    ///               compact 同 json，但不縮排
+    ///               ndjson  每列一筆紀錄，不分組
+    ///        compact 及 ndjson 一定分頁(未指定 limit 時每頁 DefaultListPageSize 筆)，
+    ///        回應大小不會隨範本數量增加；json 未指定 cursor、limit 時維持原本的完整列表
+    ///        欄位依 ListFields 的順序傳回；不認得或重複的參數視爲錯誤
+    void listAPI(RequestContext& context)
     {
-         auto session = getDataSession();
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
+
+        std::string format(context.query("format"));
+        std::vector<std::string> cnames = splitQueryList(context.query("cname"));
+        const std::vector<std::string> requestFields = splitQueryList(context.query("fields"));
+        const bool paged = format == "compact" || format == "ndjson"
+                        || !context.query("cursor").empty() || !context.query("limit").empty();
+        unsigned long cursor = 0;
+        unsigned long limit = DefaultListPageSize;
+
+        bool valid = context.hasOnlyQuery({"cname", "fields", "cursor", "limit", "format"})
+                  && getQueryNumber(context, "cursor", cursor)
+                  && getQueryNumber(context, "limit", limit)
+                  && (format.empty() || format == "json" || format == "compact" || format == "ndjson");
+        for (const auto& field : requestFields)
+        {
+            if (std::find(ListFields.begin(), ListFields.end(), field) == ListFields.end())
+                valid = false;
+        }
 
-        // 查詢範本類別列表
-        std::vector<std::string> groups;
-        session << "SELECT cname FROM repository GROUP BY cname", into(groups), now;
+        // 整理參數，意義相同的 request 使用同一份快取
+        if (format.empty())
+            format = "json";
+        std::sort(cnames.begin(), cnames.end());
+        cnames.erase(std::unique(cnames.begin(), cnames.end()), cnames.end());
+        // 每個類別都是一個 SQL 參數，不能超過 SQLite 的上限
+        if (cnames.size() > MaxListGroups)
+            valid = false;
 
-        // 依據範本類別分組
-        Poco::JSON::Object json;
-        for (auto group : groups)
+        if (!valid)
+        {
+            OxOOL::HttpHelper::sendErrorAndShutdown(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST,
+                socket, "Invalid query parameter.");
+            return;
+        }
+
+        std::vector<std::string> fields;
+        for (const auto& field : ListFields)
+        {
+            if (requestFields.empty()
+                || std::find(requestFields.begin(), requestFields.end(), field) != requestFields.end())
+                fields.push_back(field);
+        }
+        limit = std::clamp(limit, 1UL, MaxListPageSize);
+
+        // 快取 key 只由整理過的參數組成，類別名稱是唯一不固定的部分，放在最後
+        std::string cacheKey = "list|" + format + "|" + Poco::cat(std::string(","), fields.begin(), fields.end());
+        cacheKey += paged ? "|" + std::to_string(cursor) + ":" + std::to_string(limit) : std::string("|all");
+        cacheKey += "|" + Poco::cat(std::string(","), cnames.begin(), cnames.end());
+
+        // 先取目前版本，查詢期間有新的異動時，快取的內容不會比版本舊
+        const unsigned long revision = mRevision;
+        if (auto cached = findCachedResponse(cacheKey, revision))
+        {
+            sendCachedResponse(context, *cached);
+            return;
+        }
+
+        // 組合查詢指令
+        std::string sql = "SELECT id, cname";
+        for (const auto& field : fields)
+            sql += ", " + field;
+        sql += " FROM repository WHERE id>?";
+        if (!cnames.empty())
+        {
+            sql += " AND cname IN (?";
+            for (std::size_t i = 1; i < cnames.size(); i++)
+                sql += ", ?";
+            sql += ")";
+        }
+        sql += " ORDER BY id";
+        // 多取一筆，用來判斷是否還有下一頁
+        unsigned long fetch = limit + 1;
+        if (paged)
+            sql += " LIMIT ?";
+
+        std::string body;
+        std::string mimeType = "application/json; charset=utf-8";
+        auto cached = std::make_shared<CachedResponse>();
+        try
         {
-            Poco::JSON::Array groupArray;
-            // 查詢各組明細
+            auto session = getDataSession();
             Poco::Data::Statement select(session);
-            select << "SELECT docname, endpt, extname, uptime FROM repository WHERE cname=?", use(group), now;
+            select << sql, use(cursor);
+            for (const auto& cname : cnames)
+                select, use(cname);
+            if (paged)
+                select, use(fetch);
+            select.execute();
             Poco::Data::RecordSet rs(select);
 
-            std::size_t cols = rs.columnCount(); // 取欄位數
-            // 遍歷所有資料列
-            for (auto row : rs)
+            const bool more = paged && rs.rowCount() > limit;
+            const std::size_t rows = more ? limit : rs.rowCount();
+
+            if (format == "ndjson")
+            {
+                // 逐列輸出，不建立 JSON 物件
+                mimeType = "application/x-ndjson; charset=utf-8";
+                for (std::size_t row = 0; row < rows; row++)
+                {
+                    body += "{\"cname\":";
+                    appendJSONString(body, rs.value(1, row).convert<std::string>());
+                    for (std::size_t col = 0; col < fields.size(); col++)
+                    {
+                        body += ",\"" + fields[col] + "\":";
+                        appendJSONString(body, rs.value(col + 2, row).convert<std::string>());
+                    }
+                    body += "}\n";
+                }
+            }
+            else
             {
-                // 轉為 JSON 物件
-                Poco::JSON::Object obj;
-                for (std::size_t col = 0; col < cols ; col++)
+                // 依據範本類別分組
+                std::map<std::string, Poco::JSON::Array> groups;
+                for (std::size_t row = 0; row < rows; row++)
                 {
-                    obj.set(rs.columnName(col), row.get(col));
+                    Poco::JSON::Object obj;
+                    for (std::size_t col = 0; col < fields.size(); col++)
+                        obj.set(fields[col], rs.value(col + 2, row));
+
+                    groups[rs.value(1, row).convert<std::string>()].add(obj);
                 }
-                // 加入該組陣列
-                groupArray.add(obj);
+
+                Poco::JSON::Object json;
+                for (const auto& group : groups)
+                    json.set(group.first, group.second);
+
+                std::ostringstream oss;
+                json.stringify(oss, format == "compact" ? 0 : 4);
+                body = oss.str();
             }
 
-            // 完成一組
-            json.set(group, groupArray);
+            // 還有下一頁
+            if (more)
+                cached->headers.emplace_back("X-Next-Cursor", rs.value(0, rows - 1).convert<std::string>());
+        }
+        catch(const Poco::Exception& exc)
+        {
+            LOG_ERR("Admin module [" << getDetail().name << "] list:" << exc.displayText());
+            OxOOL::HttpHelper::sendErrorAndShutdown(
+                Poco::Net::HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, socket);
+            return;
+        }
+
+        cached->key = cacheKey;
+        cached->revision = revision;
+        cached->mimeType = mimeType;
+        cached->bodies[ContentEncoding::IDENTITY] = std::make_shared<const std::string>(std::move(body));
+
+        storeCachedResponse(cached);
+        sendCachedResponse(context, *cached);
+    }
+
+    /// @brief 傳回某個版本之後的異動紀錄，例如 /changes?since=123&limit=500
+    ///        client 依據傳回的 revision，下次從該版本繼續查詢即可
+    void changesAPI(RequestContext& context)
+    {
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
+        unsigned long since = 0;
+        unsigned long limit = MaxChangesPerRequest;
+        if (!context.hasOnlyQuery({"since", "limit"})
+            || !getQueryNumber(context, "since", since) || !getQueryNumber(context, "limit", limit))
+        {
+            OxOOL::HttpHelper::sendErrorAndShutdown(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST,
+                socket, "Invalid query parameter.");
+            return;
+        }
+        limit = std::clamp(limit, 1UL, MaxChangesPerRequest);
+
+        // 先取目前版本，避免查詢期間有新的異動，造成 client 漏掉紀錄
+        const unsigned long revision = mRevision;
+        const std::string cacheKey = "changes|" + std::to_string(since) + "|" + std::to_string(limit);
+        if (auto cached = findCachedResponse(cacheKey, revision))
+        {
+            sendCachedResponse(context, *cached);
+            return;
+        }
+
+        std::vector<Poco::Tuple<unsigned long, std::string, std::string,
+            std::string, std::string, std::string, std::string>> records;
+        // 多取一筆，用來判斷是否還有剩餘紀錄
+        unsigned long fetch = limit + 1;
+        auto session = getDataSession();
+        session << "SELECT revision, action, endpt, cname, docname, extname, uptime "
+                << "FROM changelog WHERE revision>? AND revision<=? "
+                << "ORDER BY revision LIMIT ?",
+                use(since), use(revision), use(fetch), into(records), now;
+
+        const bool more = records.size() > limit;
+        if (more)
+            records.resize(limit);
+
+        Poco::JSON::Array changes;
+        for (const auto& record : records)
+        {
+            Poco::JSON::Object change;
+            change.set("rev", record.get<0>());
+            change.set("op", record.get<1>());
+            change.set("endpt", record.get<2>());
+            // 刪除只需要 endpt
+            if (record.get<1>() != TemplateCatalog::ActionName[ActionType::DELETE])
+            {
+                change.set("cname", record.get<3>());
+                change.set("docname", record.get<4>());
+                change.set("extname", record.get<5>());
+                change.set("uptime", record.get<6>());
+            }
+            changes.add(change);
         }
 
+        Poco::JSON::Object json;
+        // 還有剩餘紀錄時，傳回最後一筆的版本，client 以此版本繼續查詢
+        json.set("revision", more ? records.back().get<0>() : revision);
+        json.set("more", more);
+        json.set("changes", changes);
+
         std::ostringstream oss;
-        json.stringify(oss, 4);
-        OxOOL::HttpHelper::sendResponseAndShutdown(socket, oss.str());
+        json.stringify(oss);
+
+        auto cached = std::make_shared<CachedResponse>();
+        cached->key = cacheKey;
+        cached->revision = revision;
+        cached->mimeType = "application/json; charset=utf-8";
+        cached->bodies[ContentEncoding::IDENTITY] = std::make_shared<const std::string>(oss.str());
+
+        storeCachedResponse(cached);
+        sendCachedResponse(context, *cached);
     }
 
-    void syncAPI(const Poco::Net::HTTPRequest& request,
-                 const std::shared_ptr<StreamSocket>& socket)
+    /// @brief 取得快取的回應，沒有快取或倉庫版本不同時傳回 nullptr
+    std::shared_ptr<CachedResponse> findCachedResponse(const std::string& key,
+                                                       const unsigned long revision)
     {
-        // 讀取 HTTML Form.
-        Poco::MemoryInputStream message(&socket->getInBuffer()[0],
-                                        socket->getInBuffer().size());
-        const Poco::Net::HTMLForm form(request, message);
+        std::lock_guard<std::mutex> lock(mResponseCacheMutex);
+        if (auto it = mResponseCache.find(key); it != mResponseCache.end())
+        {
+            if ((*it->second)->revision == revision)
+            {
+                mResponseCacheOrder.splice(mResponseCacheOrder.begin(), mResponseCacheOrder, it->second);
+                return *it->second;
+            }
+
+            mResponseCacheBytes -= (*it->second)->bytes;
+            mResponseCacheOrder.erase(it->second);
+            mResponseCache.erase(it);
+        }
+        return nullptr;
+    }
+
+    /// @brief 存入快取，用量超過上限時清除最久沒有使用的回應
+    ///        太大的回應不快取，避免一筆就擠掉其他回應
+    void storeCachedResponse(const std::shared_ptr<CachedResponse>& cached)
+    {
+        cached->bytes = sizeof(CachedResponse) + cached->key.size() * 2 + cached->mimeType.size()
+                      + cached->bodies[ContentEncoding::IDENTITY]->size();
+        for (const auto& header : cached->headers)
+            cached->bytes += header.first.size() + header.second.size();
+        if (cached->bytes > MaxCachedResponseBytes / 4)
+            return;
+
+        std::lock_guard<std::mutex> lock(mResponseCacheMutex);
+        if (auto it = mResponseCache.find(cached->key); it != mResponseCache.end())
+        {
+            mResponseCacheBytes -= (*it->second)->bytes;
+            mResponseCacheOrder.erase(it->second);
+            mResponseCache.erase(it);
+        }
+
+        mResponseCacheOrder.push_front(cached);
+        mResponseCache[cached->key] = mResponseCacheOrder.begin();
+        mResponseCacheBytes += cached->bytes;
+        trimResponseCache();
+    }
+
+    /// @brief 清除最久沒有使用的回應，直到用量不超過上限，呼叫前必須持有 mResponseCacheMutex
+    void trimResponseCache()
+    {
+        while (mResponseCacheBytes > MaxCachedResponseBytes && !mResponseCacheOrder.empty())
+        {
+            const std::shared_ptr<CachedResponse>& oldest = mResponseCacheOrder.back();
+            mResponseCacheBytes -= oldest->bytes;
+            mResponseCache.erase(oldest->key);
+            mResponseCacheOrder.pop_back();
+        }
+    }
+
+    /// @brief 依據 client 的 Accept-Encoding 傳回快取的回應，需要的壓縮結果不存在時才壓縮
+    void sendCachedResponse(RequestContext& context, CachedResponse& cached)
+    {
+        const std::shared_ptr<const std::string> identity = cached.bodies[ContentEncoding::IDENTITY];
+
+        ContentEncoding::Type encoding = ContentEncoding::IDENTITY;
+        if (identity->size() >= MinCompressSize && ContentEncoding::isCompressible(cached.mimeType))
+            encoding = ContentEncoding::negotiate(context.request().get("Accept-Encoding", ""));
+
+        std::shared_ptr<const std::string> body;
+        {
+            std::lock_guard<std::mutex> lock(mResponseCacheMutex);
+            body = cached.bodies[encoding];
+        }
+
+        if (!body)
+        {
+            // 壓縮時不持有鎖，同時有多個連線時可能重複壓縮，結果相同
+            std::string encoded = ContentEncoding::encode(*identity, encoding);
+            if (encoded.empty() || encoded.size() >= identity->size())
+                body = identity;
+            else
+                body = std::make_shared<const std::string>(std::move(encoded));
+
+            std::lock_guard<std::mutex> lock(mResponseCacheMutex);
+            if (!cached.bodies[encoding])
+            {
+                cached.bodies[encoding] = body;
+                // 仍在快取中的回應，壓縮結果也計入用量
+                auto it = mResponseCache.find(cached.key);
+                if (body != identity && it != mResponseCache.end() && it->second->get() == &cached)
+                {
+                    cached.bytes += body->size();
+                    mResponseCacheBytes += body->size();
+                    trimResponseCache();
+                }
+            }
+        }
+
+        Poco::Net::HTTPResponse response;
+        for (const auto& header : cached.headers)
+            response.set(header.first, header.second);
+
+        response.set("Vary", "Accept-Encoding");
+        if (body != identity)
+            response.set("Content-Encoding", ContentEncoding::name(encoding));
+
+        OxOOL::HttpHelper::sendResponseAndShutdown(context.socket(), *body,
+            Poco::Net::HTTPResponse::HTTP_OK, cached.mimeType, &response);
+    }
+
+    /// @brief 等待範本異動(long-poll)，例如 /watch?since=123&timeout=60
+    ///        倉庫版本大於 since 時立即回應，否則保留連線，直到有異動或逾時才回應
+    void watchAPI(RequestContext& context)
+    {
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
+        unsigned long since = 0;
+        unsigned long timeout = DefaultWatchTimeout;
+        if (!getQueryNumber(context, "since", since) || !getQueryNumber(context, "timeout", timeout))
+        {
+            OxOOL::HttpHelper::sendErrorAndShutdown(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST,
+                socket, "Invalid query parameter.");
+            return;
+        }
+        timeout = std::min(timeout, MaxWatchTimeout);
+
+        {
+            std::lock_guard<std::mutex> lock(mWatchMutex);
+            // 已經有新版本，或者不等待，就不必保留連線
+            if (since >= mRevision && timeout > 0)
+            {
+                if (mWatchers.size() >= MaxWatchers)
+                {
+                    OxOOL::HttpHelper::sendErrorAndShutdown(
+                        Poco::Net::HTTPResponse::HTTP_SERVICE_UNAVAILABLE, socket,
+                        "Too many watchers.");
+                    return;
+                }
+
+                const auto expire = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+                const bool earliest = mWatchers.empty() || expire < mWatchers.begin()->first;
+                mWatchers.emplace(expire, Watcher{since, socket});
+                // 連線移到 mWatchPoll(目前的執行緒不再存取)，之後由它回應，不佔用執行緒
+                mWatchPoll->insertNewSocket(socket);
+                // 逾時時間比目前等待的都早，要喚醒執行緒重新計算等待時間
+                if (earliest)
+                    mWatchCond.notify_one();
+                return;
+            }
+        }
+
+        sendWatchResponse(socket);
+    }
+
+    /// @brief 回應 /watch 的連線，傳回目前倉庫版本
+    void sendWatchResponse(const std::shared_ptr<StreamSocket>& socket)
+    {
+        const unsigned long revision = mRevision;
+        OxOOL::HttpHelper::sendResponseAndShutdown(socket,
+            "{\"revision\":" + std::to_string(revision) + "}",
+            Poco::Net::HTTPResponse::HTTP_OK, "application/json; charset=utf-8");
+    }
+
+    /// @brief 通知等待中的連線，倉庫版本已變更
+    void notifyWatchers()
+    {
+        std::lock_guard<std::mutex> lock(mWatchMutex);
+        if (!mWatchers.empty())
+            mWatchCond.notify_one();
+    }
+
+    /// @brief 單一執行緒負責排程所有 /watch 連線，有異動時一次回應全部，或個別逾時回應
+    ///        連線屬於 mWatchPoll，這裡只挑出要回應的連線，交回 mWatchPoll 的執行緒送出
+    void watchLoop()
+    {
+        std::unique_lock<std::mutex> lock(mWatchMutex);
+        while (!mWatchStop)
+        {
+            // 每次等待前都先檢查，等待期間送來的異動通知都要持有 mWatchMutex，不會遺失
+            const auto current = std::chrono::steady_clock::now();
+            const unsigned long revision = mRevision;
+
+            // 取出已有新版本或已逾時的連線
+            std::vector<std::weak_ptr<StreamSocket>> ready;
+            for (auto it = mWatchers.begin(); it != mWatchers.end(); )
+            {
+                if (it->second.since < revision || it->first <= current)
+                {
+                    ready.push_back(it->second.socket);
+                    it = mWatchers.erase(it);
+                }
+                else
+                    ++it;
+            }
+
+            if (!ready.empty())
+            {
+                mWatchPoll->addCallback([this, ready]()
+                {
+                    for (const auto& weak : ready)
+                    {
+                        // client 可能已經斷線
+                        auto socket = weak.lock();
+                        if (socket && !socket->isClosed())
+                            sendWatchResponse(socket);
+                    }
+                });
+            }
 
-        const std::string jsonStr = form.get("data", "{}");
+            if (mWatchers.empty())
+                mWatchCond.wait(lock);
+            else
+                mWatchCond.wait_until(lock, mWatchers.begin()->first);
+        }
+    }
 
+    void syncAPI(RequestContext& context)
+    {
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
         bool syntaxError = false;
 
         // 製作暫存路徑
-        const Poco::Path tmpPath = Poco::Path::forDirectory(Poco::TemporaryFile::tempName());
+        const Poco::Path tmpPath = Poco::Path::forDirectory(Poco::TemporaryFile::tempName(getTempPath()));
         Poco::File(tmpPath).createDirectories();
         chmod(tmpPath.toString().c_str(), S_IXUSR | S_IWUSR | S_IRUSR);
 
         try
         {
-            Poco::JSON::Parser parser;
-            auto result = parser.parse(jsonStr);
-            const Poco::JSON::Object::Ptr json = result.extract<Poco::JSON::Object::Ptr>();
+            const Poco::JSON::Object::Ptr json = context.json("data");
 
             // json 結構檢查
             for (auto it = json->begin(); it != json->end() ; ++it)
@@ -572,16 +1246,23 @@ private:
                     Poco::JSON::Object::Ptr object = obj->extract<Poco::JSON::Object::Ptr>();
                     // 利用 endpt 取得原始記錄
                     std::string endpt = object->getValue<std::string>("endpt");
+                    const auto readLock = mEndptLocks.lockRead(endpt);
                     RepositoryStruct repo = getRepository(endpt);
 
                     // 原始檔案
-                    Poco::File sourceFile(getRepositoryPath() + "/" + repo.endpt + "." + repo.extname);
+                    const LocalFile sourceFile = getTemplateFile(repo);
                     const std::string destFile = repo.docname + "." + repo.extname;
                     // 檔案存在就複製
-                    if (sourceFile.exists())
+                    if (!sourceFile.empty())
                     {
-                        // 複製到群組目錄下
-                        sourceFile.copyTo(groupPath.toString() + destFile);
+                        // 複製到群組目錄下，常用範本直接從記憶體寫入
+                        if (auto data = getHotTemplate(repo, sourceFile.path()))
+                        {
+                            std::ofstream out(groupPath.toString() + destFile, std::ios::binary);
+                            out.write(data->data(), data->size());
+                        }
+                        else
+                            Poco::File(sourceFile.path()).copyTo(groupPath.toString() + destFile);
                     }
                 }
             }
@@ -600,7 +1281,7 @@ private:
         else
         {
             // 壓縮成 zip 檔案
-            const std::string zipFile = Poco::TemporaryFile::tempName() + ".zip";
+            const std::string zipFile = Poco::TemporaryFile::tempName(getTempPath()) + ".zip";
 
             std::ofstream zipOut(zipFile, std::ios::binary);
             Poco::Zip::Compress compress(zipOut, true);
@@ -609,7 +1290,8 @@ private:
 
             // 傳回檔案
             Poco::Net::HTTPResponse response;
-            response.set("Content-Disposition", "attachment; filename=\"" + zipFile + "\"");
+            response.set("Content-Disposition",
+                "attachment; filename=\"" + Poco::Path(zipFile).getFileName() + "\"");
             OxOOL::HttpHelper::sendFileAndShutdown(socket, zipFile,
                 "application/octet-stream", &response, true);
             // 移除檔案
@@ -620,14 +1302,65 @@ private:
         Poco::File(tmpPath).remove(true);
     }
 
-    void uploadAPI(const Poco::Net::HTTPRequest& request,
-                   const std::shared_ptr<StreamSocket>& socket)
+    /// @brief 下載整個群組的範本(form 欄位 cname)，傳回預先壓縮好的 zip 檔
+    ///        zip 內容與 /sync 相同，回應的 ETag 只在群組內的範本異動後才改變
+    ///        群組有異動時，背景重建完成前仍傳回舊的壓縮檔及舊的 ETag
+    void syncGroupAPI(RequestContext& context)
+    {
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
+        const std::string cname(context.get("cname"));
+        if (cname.empty())
+        {
+            OxOOL::HttpHelper::sendErrorAndShutdown(
+                Poco::Net::HTTPResponse::HTTP_BAD_REQUEST, socket, "No cname provide.");
+            return;
+        }
+
+        bool ready = false;
+        {
+            std::lock_guard<std::mutex> lock(mBundleMutex);
+            ready = mBundleRevisions.count(cname) != 0 || mEmptyGroups.count(cname) != 0;
+        }
+        // 還沒有壓縮檔(而且不是已知的空群組)時才在前景建立
+        if (!ready)
+            buildBundle(cname);
+
+        const std::string bundleFile = getBundleFile(cname);
+        std::string etag;
+        {
+            std::lock_guard<std::mutex> lock(mBundleMutex);
+            if (auto it = mBundleRevisions.find(cname); it != mBundleRevisions.end())
+                etag = '"' + std::to_string(it->second) + '"';
+        }
+
+        if (etag.empty() || !Poco::File(bundleFile).exists())
+        {
+            OxOOL::HttpHelper::sendErrorAndShutdown(
+                Poco::Net::HTTPResponse::HTTP_NOT_FOUND, socket, "Group not found.");
+            return;
+        }
+
+        Poco::Net::HTTPResponse response;
+        response.set("ETag", etag);
+        // client 手上已經是最新的
+        if (context.request().get("If-None-Match", "") == etag)
+        {
+            OxOOL::HttpHelper::sendResponseAndShutdown(socket, "",
+                Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED, "text/plain", &response);
+            return;
+        }
+
+        response.set("Content-Disposition",
+            "attachment; filename=\"" + Poco::Path(bundleFile).getFileName() + "\"");
+        OxOOL::HttpHelper::sendFileAndShutdown(socket, bundleFile,
+            "application/octet-stream", &response, true);
+    }
+
+    void uploadAPI(RequestContext& context)
     {
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
         // 讀取 HTTML Form.
-        OxOOL::HttpHelper::PartHandler partHandler;
-        Poco::MemoryInputStream message(&socket->getInBuffer()[0],
-                                        socket->getInBuffer().size());
-        const Poco::Net::HTMLForm form(request, message, partHandler);
+        const Poco::Net::HTMLForm& form = context.form();
 
         // 從 form 取值
         RepositoryStruct repo =
@@ -636,24 +1369,45 @@ private:
             endpt:   form.get("endpt", ""),
             docname: form.get("docname", ""),
             extname: form.get("extname", ""),
-            uptime:  form.get("uptime", "")
+            uptime:  form.get("uptime", ""),
+            version: makeVersion()
         };
 
         // 有收到檔案
-        if (!partHandler.empty())
+        if (context.hasFile())
         {
-            const Poco::File recivedFile(partHandler.getFilename());
-            const std::string newName = getRepositoryPath() + "/"
-                                      + form.get("endpt") + "." + form.get("extname");
-            // 收到的檔案複製一份並改名，存到 RepositoryPath 路徑下
-            recivedFile.copyTo(newName);
-            // 移除收到的檔案
-            partHandler.removeFiles();
+            const auto writeLock = mEndptLocks.lockWrite(repo.endpt);
+            repo.size = Poco::File(context.getFilename()).getSize();
+            repo.hash = getFileHash(context.getFilename());
+            // 先粗略檢查，明顯超過時不必存入檔案(確實的檢查在更新資料庫時)
+            if (!checkQuota(repo.size, 0))
+            {
+                OxOOL::HttpHelper::sendErrorAndShutdown(
+                    Poco::Net::HTTPResponse::HTTP_INSUFFICIENT_STORAGE, socket,
+                    "Repository quota exceeded.");
+                return;
+            }
 
-            // 更新資料庫(新增)
-            updateRepositoryData(ActionType::ADD, repo);
+            // 收到的檔案存成新版本檔案(收到的檔案由 context 移除)
+            storeTemplateFile(context.getFilename(), repo);
 
-            OxOOL::HttpHelper::sendResponseAndShutdown(socket, "Upload Success.");
+            // 更新資料庫(新增)
+            const UpdateResult result = updateRepositoryData(ActionType::ADD, repo);
+            if (result == UpdateResult::UPDATE_OK)
+            {
+                OxOOL::HttpHelper::sendResponseAndShutdown(socket, "Upload Success.");
+            }
+            else
+            {
+                mStorage->remove(TemplateCatalog::getShardedFileName(repo));
+                if (result == UpdateResult::UPDATE_QUOTA_EXCEEDED)
+                    OxOOL::HttpHelper::sendErrorAndShutdown(
+                        Poco::Net::HTTPResponse::HTTP_INSUFFICIENT_STORAGE, socket,
+                        "Repository quota exceeded.");
+                else
+                    OxOOL::HttpHelper::sendErrorAndShutdown(
+                        Poco::Net::HTTPResponse::HTTP_CONFLICT, socket, "Upload failed.");
+            }
         }
         else // 沒有收到檔案
         {
@@ -662,53 +1416,61 @@ private:
         }
     }
 
-    void updateAPI(const Poco::Net::HTTPRequest& request,
-                   const std::shared_ptr<StreamSocket>& socket)
+    void updateAPI(RequestContext& context)
     {
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
         // 讀取 HTTML Form.
-        OxOOL::HttpHelper::PartHandler partHandler;
-        Poco::MemoryInputStream message(&socket->getInBuffer()[0],
-                                        socket->getInBuffer().size());
-        const Poco::Net::HTMLForm form(request, message, partHandler);
+        const Poco::Net::HTMLForm& form = context.form();
 
         // 有收到檔案
-        if (!partHandler.empty())
+        if (context.hasFile())
         {
-            // 收到的檔案
-            const Poco::File recivedFile(partHandler.getFilename());
             std::string endpt = form.get("endpt", "");
+            const auto writeLock = mEndptLocks.lockWrite(endpt);
             // 讀取該筆原始記錄
             RepositoryStruct repo = getRepository(endpt);
-            // 確實有資料
-            if (repo.id != 0)
+
+            const unsigned long size = Poco::File(context.getFilename()).getSize();
+            // 先粗略檢查，明顯超過時不必存入檔案(確實的檢查在更新資料庫時)
+            // 更新後目前版本變成前一版本，原本的前一版本及差異檔停用
+            if (!checkQuota(size, repo.prevsize + repo.deltasize))
             {
-                Poco::File oldFile(getRepositoryPath() + "/" + repo.endpt + "." + repo.extname);
-                // 舊檔案存在就刪除它
-                if (oldFile.exists())
-                {
-                    oldFile.remove();
-                }
-                // 更新資料庫(刪除)
-                updateRepositoryData(ActionType::DELETE, repo);
+                OxOOL::HttpHelper::sendErrorAndShutdown(
+                    Poco::Net::HTTPResponse::HTTP_INSUFFICIENT_STORAGE, socket,
+                    "Repository quota exceeded.");
+                return;
             }
 
             // 紀錄新資料
             repo.endpt   = endpt;
             repo.extname = form.get("extname", "");
             repo.uptime  = form.get("uptime", "");
-            // 新的檔名應該要一樣
-            const std::string newName = getRepositoryPath() + "/"
-                                        + repo.endpt + "." + repo.extname;
-            // 收到的檔案複製一份並改名，存到 RepositoryPath 路徑下
-            recivedFile.copyTo(newName);
-
-            // 更新資料庫(新增)
-            updateRepositoryData(ActionType::ADD, repo);
-
-            // 移除收到的檔案
-            partHandler.removeFiles();
-
-            OxOOL::HttpHelper::sendResponseAndShutdown(socket, "Update Success.");
+            repo.version = makeVersion();
+            repo.size    = size;
+            repo.hash    = getFileHash(context.getFilename());
+            // 收到的檔案存成新版本檔案，舊版本檔案不動，正在下載的連線不受影響
+            storeTemplateFile(context.getFilename(), repo);
+
+            // 更新資料庫(原本有資料就更新，否則新增)，舊版本在同一個 transaction 中改爲前一版本
+            const UpdateResult result =
+                updateRepositoryData(repo.id != 0 ? ActionType::UPDATE : ActionType::ADD, repo);
+            if (result == UpdateResult::UPDATE_OK)
+            {
+                // 背景產生前一版本到新版本的差異檔，產生前下載會傳回完整檔案
+                queueDelta(repo.endpt);
+                OxOOL::HttpHelper::sendResponseAndShutdown(socket, "Update Success.");
+            }
+            else
+            {
+                mStorage->remove(TemplateCatalog::getShardedFileName(repo));
+                if (result == UpdateResult::UPDATE_QUOTA_EXCEEDED)
+                    OxOOL::HttpHelper::sendErrorAndShutdown(
+                        Poco::Net::HTTPResponse::HTTP_INSUFFICIENT_STORAGE, socket,
+                        "Repository quota exceeded.");
+                else
+                    OxOOL::HttpHelper::sendErrorAndShutdown(
+                        Poco::Net::HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, socket, "Update failed.");
+            }
         }
         else // 沒有收到檔案
         {
@@ -717,34 +1479,24 @@ private:
         }
     }
 
-    void deleteAPI(const Poco::Net::HTTPRequest& request,
-                   const std::shared_ptr<StreamSocket>& socket)
+    void deleteAPI(RequestContext& context)
     {
-        // 讀取 HTTML Form.
-        Poco::MemoryInputStream message(&socket->getInBuffer()[0],
-                                        socket->getInBuffer().size());
-        const Poco::Net::HTMLForm form(request, message);
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
+        const std::string endpt(context.get("endpt"));
 
-        // 從 form 取值
-        RepositoryStruct repo =
-        {
-            endpt: form.get("endpt", ""),
-            extname: form.get("extname", "")
-        };
-
-        if (repo.endpt.empty())
+        if (endpt.empty())
         {
             OxOOL::HttpHelper::sendErrorAndShutdown(
                 Poco::Net::HTTPResponse::HTTP_BAD_REQUEST, socket, "No endpt provide.");
         }
         else
         {
-            Poco::File targetFile(getRepositoryPath() + "/" + repo.endpt + "." + repo.extname);
-            // 指定檔案存在
-            if (targetFile.exists())
+            const auto writeLock = mEndptLocks.lockWrite(endpt);
+            RepositoryStruct repo = getRepository(endpt);
+            // 指定記錄存在
+            if (repo.id != 0)
             {
-                targetFile.remove(); // 刪除指定檔案
-                // 更新資料庫(刪除)
+                // 更新資料庫(刪除)，檔案會先停用，過一段時間後才刪除
                 updateRepositoryData(ActionType::DELETE, repo);
                 OxOOL::HttpHelper::sendResponseAndShutdown(socket, "Delete success.");
             }
@@ -757,33 +1509,83 @@ private:
         }
     }
 
-    void downloadAPI(const Poco::Net::HTTPRequest& request,
-                     const std::shared_ptr<StreamSocket>& socket)
+    /// @brief 下載範本，回應的 ETag 爲檔案內容的 MD5
+    ///        client 以 If-Match header 送出手上版本的 MD5(或以 form 欄位 uptime 送出上傳時間):
+    ///        與目前版本相同時回應 304，與前一版本相同時只傳回差異檔，否則傳回完整檔案
+    void downloadAPI(RequestContext& context)
     {
-        // 讀取 HTTML Form.
-        Poco::MemoryInputStream message(&socket->getInBuffer()[0],
-                                        socket->getInBuffer().size());
-        const Poco::Net::HTMLForm form(request, message);
-
+        const std::shared_ptr<StreamSocket>& socket = context.socket();
         // 讀取紀錄
-        std::string endpt = form.get("endpt", "");
-        RepositoryStruct repo = getRepository(endpt);
-        // 有記錄
-        if (repo.id != 0)
+        const std::string endpt(context.get("endpt"));
+        // client 手上的版本
+        std::string clientHash = context.request().get("If-Match", "");
+        clientHash.erase(std::remove(clientHash.begin(), clientHash.end(), '"'), clientHash.end());
+        const std::string clientUptime(context.get("uptime"));
+
+        RepositoryStruct repo;
+        LocalFile requestFile;
+        LocalFile deltaFile;
         {
-            std::string requestFile = getRepositoryPath() + "/" + repo.endpt + "." + repo.extname;
-            // 檔案存在
-            if (Poco::File(requestFile).exists())
+            // 版本檔案不會被改寫，只需在找檔案時鎖定，傳送期間不必阻擋寫入
+            const auto readLock = mEndptLocks.lockRead(endpt);
+            repo = getRepository(endpt);
+            // 有記錄
+            if (repo.id != 0)
+            {
+                requestFile = getTemplateFile(repo);
+
+                // client 持有前一版本
+                const bool hasPrevious = !repo.prevfile.empty()
+                    && ((!clientHash.empty() && clientHash == repo.prevhash)
+                        || (!clientUptime.empty() && clientUptime == repo.prevuptime
+                            && clientUptime != repo.uptime));
+                if (hasPrevious)
+                    deltaFile = mStorage->getLocalFile(TemplateCatalog::getDeltaFileName(repo));
+            }
+        }
+
+        // 檔案存在
+        if (!requestFile.empty())
+        {
+            const std::string fileName = repo.docname + "." + repo.extname;
+
+            Poco::Net::HTTPResponse response;
+            if (!repo.hash.empty())
+                response.set("ETag", '"' + repo.hash + '"');
+
+            // client 已經是最新版本
+            if (!clientHash.empty() && clientHash == repo.hash)
             {
-                const std::string fileName = repo.docname + "." + repo.extname;
+                OxOOL::HttpHelper::sendResponseAndShutdown(socket, "",
+                    Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED, "text/plain", &response);
+                return;
+            }
+
+            // 只傳回差異檔，套用在前一版本(X-Delta-Base)即可得到新版本
+            if (!deltaFile.empty())
+            {
+                response.set("X-Delta-Base", '"' + repo.prevhash + '"');
+                response.set("Content-Disposition",
+                    "attachment; filename=\"" + fileName + ".delta\"");
+
+                OxOOL::HttpHelper::sendFileAndShutdown(socket, deltaFile.path(),
+                    "application/x-templaterepo-delta", &response, true);
+                return;
+            }
 
-                Poco::Net::HTTPResponse response;
-                response.set("Content-Disposition", "attachment; filename=\"" + fileName + '"');
+            response.set("Content-Disposition", "attachment; filename=\"" + fileName + '"');
 
-                OxOOL::HttpHelper::sendFileAndShutdown(socket, requestFile,
-                    "application/octet-stream", &response, true);
+            // 常用範本直接從記憶體傳送
+            if (auto data = getHotTemplate(repo, requestFile.path()))
+            {
+                OxOOL::HttpHelper::sendResponseAndShutdown(socket, *data,
+                    Poco::Net::HTTPResponse::HTTP_OK, "application/octet-stream", &response);
                 return;
             }
+
+            OxOOL::HttpHelper::sendFileAndShutdown(socket, requestFile.path(),
+                "application/octet-stream", &response, true);
+            return;
         }
         OxOOL::HttpHelper::sendErrorAndShutdown(Poco::Net::HTTPResponse::HTTP_NOT_FOUND, socket);
     }
@@ -802,17 +1604,14 @@ private:
     /// @brief 取得符合 endpt 的紀錄
     /// @param endpt
     /// @return RepositoryStruct
-    RepositoryStruct getRepository(std::string& endpt)
+    RepositoryStruct getRepository(const std::string& endpt)
     {
         RepositoryStruct repo;
 
         auto session = getDataSession();
         try
         {
-            session << "SELECT id, cname, docname, endpt, extname, uptime FROM repository WHERE endpt=?",
-                into(repo.id), into(repo.cname), into(repo.docname),
-                into(repo.endpt), into(repo.extname), into(repo.uptime),
-                use(endpt), now;
+            repo = TemplateCatalog::get(session, endpt);
         }
         catch(const Poco::Exception& exc)
         {
@@ -825,45 +1624,716 @@ private:
 
     /// @brief 更新範本資料表
     /// @param RepositoryStruc
-    /// @return
-    bool updateRepositoryData(ActionType type, RepositoryStruct& repo)
+    /// @return UPDATE_QUOTA_EXCEEDED - 超過倉庫容量上限，資料表未變更
+    UpdateResult updateRepositoryData(ActionType type, RepositoryStruct& repo)
     {
+        unsigned long revision = 0;
+        std::string previousCname;
         try
         {
             auto session = getDataSession();
-            switch (type)
-            {
-                case ActionType::ADD: // 新增
-                    session << "INSERT INTO repository (endpt, extname, cname, docname, uptime) "
-                            << "VALUES(?, ?, ?, ?, ?)",
-                            use(repo.endpt), use(repo.extname),
-                            use(repo.cname), use(repo.docname),
-                            use(repo.uptime), now;
-                    break;
+            const UpdateResult result =
+                mCatalog->update(session, type, repo, mQuotaBytes, revision, &previousCname);
+            if (result != UpdateResult::UPDATE_OK)
+                return result;
+        }
+        catch(const Poco::Exception& exc)
+        {
+            LOG_ERR("Admin module [" << getDetail().name << "] update database:" << exc.displayText());
+            return UpdateResult::UPDATE_FAILED;
+        }
 
-                case ActionType::UPDATE: // 更新
-                    break;
+        // 遞增倉庫版本編號(多個寫入同時進行時，只保留最大值)
+        unsigned long known = mRevision;
+        while (known < revision && !mRevision.compare_exchange_weak(known, revision))
+            ;
+
+        notifyWatchers();
+
+        // 重建異動到的群組壓縮檔(範本可能換到其他群組)
+        markGroupDirty(repo.cname);
+        if (!previousCname.empty() && previousCname != repo.cname)
+            markGroupDirty(previousCname);
+        return UpdateResult::UPDATE_OK;
+    }
+
+    /// @brief 刪除停用超過保留時間的版本檔案
+    void collectRetiredVersions()
+    {
+        unsigned long reclaimedBytes = 0;
+        unsigned long reclaimedFiles = 0;
+        try
+        {
+            auto session = getDataSession();
+            mCatalog->collectRetired(session, Poco::Timestamp().epochTime() - RetiredVersionGracePeriod,
+                                     reclaimedBytes, reclaimedFiles);
+        }
+        catch(const Poco::Exception& exc)
+        {
+            LOG_ERR("Admin module [" << getDetail().name << "] collect retired versions:"
+                    << exc.displayText());
+        }
+
+        mReclaimedBytes += reclaimedBytes;
+        mReclaimedFiles += reclaimedFiles;
+    }
+
+    /// @brief 刪除模組暫存目錄下過期的檔案及目錄(例如中斷的 /sync)
+    void collectTempFiles()
+    {
+        const Poco::Timestamp expired = Poco::Timestamp()
+            - static_cast<Poco::Timestamp::TimeDiff>(mConfig->getUInt("maintenance.tempMaxAge", 3600))
+                * Poco::Timestamp::resolution();
+
+        std::vector<std::string> expiredFiles;
+        for (Poco::DirectoryIterator it(getTempPath()), end; it != end; ++it)
+        {
+            if (it->getLastModified() < expired)
+                expiredFiles.push_back(it.path().toString());
+        }
+
+        for (const auto& path : expiredFiles)
+        {
+            try
+            {
+                unsigned long size = 0;
+                unsigned long files = 0;
+                Poco::File file(path);
+                if (file.isDirectory())
+                {
+                    for (Poco::SimpleRecursiveDirectoryIterator it(path), end; it != end; ++it)
+                    {
+                        if (it->isFile())
+                        {
+                            size += it->getSize();
+                            ++files;
+                        }
+                    }
+                }
+                else
+                {
+                    size = file.getSize();
+                    files = 1;
+                }
+
+                file.remove(true);
+                mReclaimedBytes += size;
+                mReclaimedFiles += files;
+            }
+            catch(const Poco::Exception& exc)
+            {
+                LOG_ERR("Admin module [" << getDetail().name << "] collect temp files:"
+                        << exc.displayText());
+            }
+        }
+    }
+
+    /// @brief 刪除倉庫內沒有任何紀錄參照，而且超過 tempMaxAge 的檔案
+    ///        例如存入新版本後、寫入資料庫前就中斷的檔案，以及中斷時留下的 .part 暫存檔
+    ///        較新的檔案可能是正在存入的版本，不處理
+    void collectOrphanFiles()
+    {
+        const Poco::Timestamp expired = Poco::Timestamp()
+            - static_cast<Poco::Timestamp::TimeDiff>(mConfig->getUInt("maintenance.tempMaxAge", 3600))
+                * Poco::Timestamp::resolution();
+
+        // 先列出檔案再讀取參照，期間才存入的檔案一定較新，不會被誤刪
+        std::vector<std::string> candidates;
+        for (const auto& name : mStorage->list())
+        {
+            if (mStorage->getLastModified(name) < expired)
+                candidates.push_back(name);
+        }
+        if (candidates.empty())
+            return;
+
+        // 版本停用時，範本資料與停用紀錄在同一個 transaction 中異動，
+        // 先讀範本再讀停用紀錄，同一個檔案至少會出現在其中一處
+        std::set<std::string> referenced;
+        auto session = getDataSession();
+        std::vector<Poco::Tuple<std::string, std::string, std::string, std::string>> records;
+        session << "SELECT endpt, extname, version, prevfile FROM repository", into(records), now;
+        for (const auto& record : records)
+        {
+            RepositoryStruct repo;
+            repo.endpt   = record.get<0>();
+            repo.extname = record.get<1>();
+            repo.version = record.get<2>();
+            // 尚未搬移到分層目錄的舊檔案也算
+            referenced.insert(TemplateCatalog::getTemplateFileName(repo));
+            referenced.insert(TemplateCatalog::getShardedFileName(repo));
+            // 前一版本及差異檔
+            if (!record.get<3>().empty())
+                referenced.insert(record.get<3>());
+            referenced.insert(TemplateCatalog::getDeltaFileName(repo));
+        }
+
+        std::vector<std::string> retiredFiles;
+        session << "SELECT file FROM retired", into(retiredFiles), now;
+        referenced.insert(retiredFiles.begin(), retiredFiles.end());
+
+        for (const auto& name : candidates)
+        {
+            if (referenced.count(name) != 0)
+                continue;
+
+            try
+            {
+                const unsigned long size = mStorage->getSize(name);
+                mStorage->remove(name);
+                mReclaimedBytes += size;
+                ++mReclaimedFiles;
+            }
+            catch(const Poco::Exception& exc)
+            {
+                LOG_ERR("Admin module [" << getDetail().name << "] collect orphan file " << name << ":"
+                        << exc.displayText());
+            }
+        }
+    }
+
+    /// @brief 補上舊版資料沒有紀錄的檔案大小及 MD5
+    void updateMissingMetadata()
+    {
+        auto session = getDataSession();
+        std::vector<std::string> endpts;
+        session << "SELECT endpt FROM repository WHERE size=0 OR hash=''", into(endpts), now;
+        for (const auto& endpt : endpts)
+        {
+            const RepositoryStruct repo = getRepository(endpt);
+            const LocalFile file = getTemplateFile(repo);
+            if (file.empty())
+                continue;
+
+            unsigned long size = Poco::File(file.path()).getSize();
+            std::string hash = getFileHash(file.path());
+            // 期間若已更新成其他版本，就不寫入
+            session << "UPDATE repository SET size=?, hash=? WHERE endpt=? AND version=?",
+                    use(size), use(hash), use(repo.endpt), use(repo.version), now;
+        }
+
+        // 前一版本是舊版資料時，也沒有紀錄大小
+        endpts.clear();
+        session << "SELECT endpt FROM repository WHERE prevfile<>'' AND prevsize=0", into(endpts), now;
+        for (const auto& endpt : endpts)
+        {
+            const RepositoryStruct repo = getRepository(endpt);
+            unsigned long prevsize = mStorage->getSize(repo.prevfile);
+            unsigned long deltasize = mStorage->getSize(TemplateCatalog::getDeltaFileName(repo));
+            session << "UPDATE repository SET prevsize=?, deltasize=? WHERE endpt=? AND version=?",
+                    use(prevsize), use(deltasize), use(repo.endpt), use(repo.version), now;
+        }
+    }
+
+    /// @brief 背景維護工作，定時清除過期的暫存檔及停用的版本檔案
+    void maintenanceLoop()
+    {
+        const std::chrono::seconds interval(mConfig->getUInt("maintenance.interval", 300));
+        std::unique_lock<std::mutex> lock(mMaintenanceMutex);
+        while (!mMaintenanceStop)
+        {
+            lock.unlock();
+            try
+            {
+                collectTempFiles();
+                collectRetiredVersions();
+                collectOrphanFiles();
+                updateMissingMetadata();
+            }
+            catch(const Poco::Exception& exc)
+            {
+                LOG_ERR("Admin module [" << getDetail().name << "] maintenance:"
+                        << exc.displayText());
+            }
+            mLastMaintenance = Poco::Timestamp().epochTime();
+            lock.lock();
+
+            mMaintenanceCond.wait_for(lock, interval, [this]{ return mMaintenanceStop; });
+        }
+    }
+
+    /// @brief 群組內的範本有異動，通知背景重建壓縮檔
+    void markGroupDirty(const std::string& cname)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mBundleMutex);
+            mDirtyGroups.insert(cname);
+            mEmptyGroups.erase(cname);
+        }
+        mBundleCond.notify_one();
+    }
+
+    /// @brief 背景重建群組壓縮檔，等待一小段時間再重建，連續上傳多個範本時只重建一次
+    void bundleLoop()
+    {
+        std::unique_lock<std::mutex> lock(mBundleMutex);
+        while (!mBundleStop)
+        {
+            mBundleCond.wait(lock, [this]{ return mBundleStop || !mDirtyGroups.empty(); });
+            mBundleCond.wait_for(lock, BundleRebuildDelay, [this]{ return mBundleStop; });
+            if (mBundleStop)
+                break;
+
+            const std::set<std::string> groups = mDirtyGroups;
+            lock.unlock();
+            for (const auto& cname : groups)
+                buildBundle(cname);
+            lock.lock();
+        }
+    }
+
+    /// @brief 重建群組壓縮檔，只查詢一次資料表，群組已沒有範本時移除壓縮檔
+    ///        版本檔案不會被改寫，停用後也會保留一段時間，打包期間不必鎖定各個範本
+    ///        新的壓縮檔就位前，舊的壓縮檔及版本都保留，重建失敗時繼續使用舊的
+    void buildBundle(const std::string& cname)
+    {
+        std::lock_guard<std::mutex> buildLock(mBundleBuildMutex);
+
+        const std::string bundleFile = getBundleFile(cname);
+        unsigned long revision = 0;
+        {
+            std::lock_guard<std::mutex> lock(mBundleMutex);
+            // 已經由其他連線重建
+            if (mDirtyGroups.erase(cname) == 0
+                && (mBundleRevisions.count(cname) != 0 || mEmptyGroups.count(cname) != 0))
+                return;
+
+            // 先取版本再查詢，之後的異動會再標記需要重建
+            revision = mRevision;
+        }
+
+        const std::string zipFile = Poco::TemporaryFile::tempName(getTempPath()) + ".zip";
+        try
+        {
+            std::vector<Poco::Tuple<std::string, std::string, std::string, std::string>> records;
+            auto session = getDataSession();
+            session << "SELECT endpt, docname, extname, version FROM repository "
+                    << "WHERE cname=? ORDER BY id", use(cname), into(records), now;
+
+            if (records.empty())
+            {
+                // 群組有範本時會再標記需要重建
+                {
+                    std::lock_guard<std::mutex> lock(mBundleMutex);
+                    mBundleRevisions.erase(cname);
+                    if (mEmptyGroups.size() >= MaxEmptyGroups)
+                        mEmptyGroups.clear();
+                    mEmptyGroups.insert(cname);
+                }
+
+                Poco::File bundle(bundleFile);
+                if (bundle.exists())
+                    bundle.remove();
+                return;
+            }
+
+            // zip 內的檔名對應到範本檔案，檔名重複時以最後一筆爲準(同 /sync)
+            std::map<std::string, LocalFile> entries;
+            for (const auto& record : records)
+            {
+                RepositoryStruct repo;
+                repo.endpt   = record.get<0>();
+                repo.docname = record.get<1>();
+                repo.extname = record.get<2>();
+                repo.version = record.get<3>();
+
+                const LocalFile sourceFile = getTemplateFile(repo);
+                if (!sourceFile.empty())
+                    entries[repo.docname + "." + repo.extname] = sourceFile;
+            }
+
+            {
+                std::ofstream zipOut(zipFile, std::ios::binary);
+                Poco::Zip::Compress compress(zipOut, true);
+                compress.addDirectory(Poco::Path::forDirectory(cname), Poco::DateTime());
+                for (const auto& entry : entries)
+                {
+                    // 範本本身就是 zip 格式，不再壓縮
+                    compress.addFile(Poco::Path(entry.second.path()), Poco::Path(cname).append(entry.first),
+                        Poco::Zip::ZipCommon::CM_STORE);
+                }
+                compress.close();
+            }
+
+            // 改名是 atomic，正在傳送舊檔的連線不受影響；檔案與 ETag 一起更換
+            std::lock_guard<std::mutex> lock(mBundleMutex);
+            Poco::File(zipFile).renameTo(bundleFile);
+            mBundleRevisions[cname] = revision;
+        }
+        catch(const Poco::Exception& exc)
+        {
+            LOG_ERR("Admin module [" << getDetail().name << "] build bundle:" << exc.displayText());
+            Poco::File tempFile(zipFile);
+            if (tempFile.exists())
+                tempFile.remove();
+        }
+    }
+
+    /// @brief 倉庫目前的用量(bytes)，包含目前版本、前一版本及差異檔
+    unsigned long getRepositoryUsage()
+    {
+        auto session = getDataSession();
+        return TemplateCatalog::getUsage(session);
+    }
+
+    /// @brief 檢查存入新檔案後，是否超過倉庫容量上限
+    /// @param newSize 新檔案大小
+    /// @param oldSize 存入後不再計入用量的檔案大小
+    /// @return true - 未超過
+    bool checkQuota(unsigned long newSize, unsigned long oldSize)
+    {
+        if (mQuotaBytes == 0)
+            return true;
+
+        return getRepositoryUsage() - oldSize + newSize <= mQuotaBytes;
+    }
+
+    /// @brief 傳回倉庫用量及背景維護結果給控制臺
+    std::string getMaintenanceStatus()
+    {
+        Poco::JSON::Object json;
+        json.set("usedBytes", getRepositoryUsage());
+        json.set("quotaBytes", mQuotaBytes);
+        json.set("reclaimedBytes", mReclaimedBytes.load());
+        json.set("reclaimedFiles", mReclaimedFiles.load());
+        json.set("lastRun", mLastMaintenance.load());
+
+        std::ostringstream oss;
+        json.stringify(oss);
+        return "maintenanceStatus " + oss.str();
+    }
+
+    /// @brief 傳回記憶體快取統計給控制臺
+    std::string getCacheStatus()
+    {
+        Poco::JSON::Object json;
+        json.set("hits", mHotCache->getHits());
+        json.set("misses", mHotCache->getMisses());
+        json.set("residentBytes", mHotCache->getResidentBytes());
+        json.set("capacity", mHotCache->getCapacity());
+        json.set("entries", mHotCache->getEntries());
+
+        std::ostringstream oss;
+        json.stringify(oss);
+        return "cacheStatus " + oss.str();
+    }
+
+    /// @brief 把舊版平放在倉庫目錄下的檔案，搬到分層目錄
+    ///        先建立 hard link，原檔案當作停用的版本，等保留時間過後才刪除，
+    ///        正在讀取舊位置的連線不受影響
+    void migrateRepository()
+    {
+        try
+        {
+            auto session = getDataSession();
+            std::vector<std::string> endpts;
+            session << "SELECT endpt FROM repository", into(endpts), now;
 
-                case ActionType::DELETE: // 刪除
-                    session << "DELETE FROM repository WHERE endpt=?", use(repo.endpt), now;
+            mMigrated = 0;
+            mMigrationTotal = endpts.size();
+            for (const auto& endpt : endpts)
+            {
+                if (mMigrationStop)
                     break;
+
+                // 重新讀取，搬移的一定是目前的版本
+                const auto writeLock = mEndptLocks.lockWrite(endpt);
+                const RepositoryStruct repo = getRepository(endpt);
+                std::string flatName = TemplateCatalog::getTemplateFileName(repo);
+                const std::string shardedName = TemplateCatalog::getShardedFileName(repo);
+                if (repo.id != 0 && mStorage->exists(flatName) && !mStorage->exists(shardedName))
+                {
+                    mStorage->link(flatName, shardedName);
+
+                    unsigned long retiredTime = Poco::Timestamp().epochTime();
+                    session << "INSERT INTO retired (file, retired) VALUES(?, ?)",
+                            use(flatName), use(retiredTime), now;
+                }
+                ++mMigrated;
             }
         }
         catch(const Poco::Exception& exc)
         {
-            LOG_ERR("Admin module [" << getDetail().name << "] update database:" << exc.displayText());
-            return false;
+            LOG_ERR("Admin module [" << getDetail().name << "] migrate repository:"
+                    << exc.displayText());
         }
 
-        return true;
+        mMigrationRunning = false;
     }
 
+    /// @brief 傳回搬移進度給控制臺
+    std::string getMigrationStatus()
+    {
+        Poco::JSON::Object json;
+        json.set("running", mMigrationRunning.load());
+        json.set("migrated", mMigrated.load());
+        json.set("total", mMigrationTotal.load());
+
+        std::ostringstream oss;
+        json.stringify(oss);
+        return "migrationStatus " + oss.str();
+    }
+
+
 private:
-    /// @brief 取得範本倉庫路徑
-    const std::string& getRepositoryPath()
+    /// @brief 讀取數字型態的 query 參數，參數不存在時保留原值
+    /// @return false - 參數不是數字
+    static bool getQueryNumber(RequestContext& context, const std::string& name,
+                               unsigned long& value)
+    {
+        const std::string_view param = context.query(name);
+        if (param.empty())
+            return true;
+
+        try
+        {
+            value = std::stoul(std::string(param));
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief 把逗號分隔的 query 參數拆成陣列
+    static std::vector<std::string> splitQueryList(const std::string_view param)
+    {
+        std::vector<std::string> list;
+        const Poco::StringTokenizer tokens(std::string(param), ",",
+            Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        list.assign(tokens.begin(), tokens.end());
+        return list;
+    }
+
+    /// @brief 把字串轉成 JSON 字串(含引號)，附加在 out 之後
+    static void appendJSONString(std::string& out, const std::string& value)
+    {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (const unsigned char c : value)
+        {
+            switch (c)
+            {
+                case '"':  out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20)
+                    {
+                        out += "\\u00";
+                        out += hex[c >> 4];
+                        out += hex[c & 0xf];
+                    }
+                    else
+                        out += c;
+                    break;
+            }
+        }
+        out += '"';
+    }
+
+    /// /list 可選擇的欄位
+    static constexpr std::array<const char*, 4> ListFields = {"docname", "endpt", "extname", "uptime"};
+    /// /list 每頁最多筆數
+    static constexpr unsigned long MaxListPageSize = 5000;
+    /// /list 分頁時，未指定 limit 的每頁筆數
+    static constexpr unsigned long DefaultListPageSize = 1000;
+    /// /list 一次最多可指定的範本類別數
+    static constexpr std::size_t MaxListGroups = 100;
+    /// 每次 /changes 最多傳回的紀錄數
+    static constexpr unsigned long MaxChangesPerRequest = 1000;
+    /// /watch 預設及最長的等待秒數
+    static constexpr unsigned long DefaultWatchTimeout = 60;
+    static constexpr unsigned long MaxWatchTimeout = 300;
+    /// 同時等待的連線數上限
+    static constexpr std::size_t MaxWatchers = 20000;
+    /// 範本異動後，等待多久才重建群組壓縮檔
+    static constexpr std::chrono::seconds BundleRebuildDelay{2};
+    /// 記住的空群組數量上限，超過時全部清除(cname 由 client 指定)
+    static constexpr std::size_t MaxEmptyGroups = 1024;
+    /// 快取的文字回應(含壓縮結果)總大小上限
+    static constexpr std::size_t MaxCachedResponseBytes = 32 * 1024 * 1024;
+    /// 小於此大小的回應不壓縮
+    static constexpr std::size_t MinCompressSize = 1024;
+    /// 停用的版本檔案保留秒數，讓正在下載的連線能完成
+    static constexpr unsigned long RetiredVersionGracePeriod = 600;
+    /// 超過此大小的檔案不產生差異檔(要整個讀進記憶體比對)
+    static constexpr unsigned long MaxDeltaFileSize = 64 * 1024 * 1024;
+
+    /// @brief 模組專用的暫存目錄
+    const std::string& getTempPath()
+    {
+        static std::string tempPath = getDocumentRoot() + "/tmp/";
+        return tempPath;
+    }
+
+    /// @brief 群組壓縮檔的存放目錄(本機資料，不放在共用儲存區)
+    const std::string& getBundlePath()
+    {
+        static std::string bundlePath = getDocumentRoot() + "/bundles/";
+        return bundlePath;
+    }
+
+    /// @brief 群組壓縮檔的路徑，cname 可能含有不能當檔名的字元，以 MD5 命名
+    std::string getBundleFile(const std::string& cname)
+    {
+        Poco::MD5Engine md5;
+        md5.update(cname);
+        return getBundlePath() + Poco::DigestEngine::digestToHex(md5.digest()) + ".zip";
+    }
+
+    /// @brief 可以直接讀取的範本檔案，檔案不存在時傳回空的 LocalFile
+    ///        讀取完成前必須保留傳回的物件，快取中的檔案才不會被移除
+    LocalFile getTemplateFile(const RepositoryStruct& repo)
+    {
+        return mStorage->getLocalFile(mCatalog->locateTemplateFile(repo));
+    }
+
+    /// @brief 產生新的版本代號
+    std::string makeVersion()
+    {
+        static std::atomic<unsigned long> sequence(0);
+        return std::to_string(Poco::Timestamp().epochMicroseconds()) + "-" + std::to_string(++sequence);
+    }
+
+    /// @brief 把收到的檔案存成範本版本檔案
+    void storeTemplateFile(const std::string& receivedFile, const RepositoryStruct& repo)
+    {
+        mStorage->store(receivedFile, TemplateCatalog::getShardedFileName(repo));
+    }
+
+    /// @brief 檔案內容的 MD5
+    static std::string getFileHash(const std::string& path)
+    {
+        Poco::MD5Engine md5;
+        std::ifstream in(path, std::ios::binary);
+        char buffer[64 * 1024];
+        while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+            md5.update(buffer, in.gcount());
+        return Poco::DigestEngine::digestToHex(md5.digest());
+    }
+
+    /// @brief 讀取整個檔案
+    static std::string readFile(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream oss;
+        oss << in.rdbuf();
+        return oss.str();
+    }
+
+    /// @brief 從記憶體快取取得範本內容，未命中而且夠常用時，讀取檔案放入快取
+    /// @param localPath 可以直接讀取的範本檔案路徑
+    /// @return 不放在快取的範本傳回 nullptr，由呼叫端直接讀取檔案
+    std::shared_ptr<const std::string> getHotTemplate(const RepositoryStruct& repo,
+                                                      const std::string& localPath)
+    {
+        // 版本檔名不同就是不同內容
+        const std::string name = TemplateCatalog::getTemplateFileName(repo);
+        if (auto data = mHotCache->get(repo.endpt, name))
+            return data;
+
+        if (!mHotCache->shouldAdmit(repo.endpt, Poco::File(localPath).getSize()))
+            return nullptr;
+
+        auto data = std::make_shared<const std::string>(readFile(localPath));
+        mHotCache->put(repo.endpt, name, data);
+        return data;
+    }
+
+    /// @brief 通知背景產生範本的差異檔
+    void queueDelta(const std::string& endpt)
     {
-        static std::string repositoryPath = getDocumentRoot() + "/repository";
-        return repositoryPath;
+        {
+            std::lock_guard<std::mutex> lock(mDeltaMutex);
+            mPendingDeltas.insert(endpt);
+        }
+        mDeltaCond.notify_one();
+    }
+
+    /// @brief 背景產生差異檔，每次取出一個範本，以產生時的最新版本爲準
+    void deltaLoop()
+    {
+        std::unique_lock<std::mutex> lock(mDeltaMutex);
+        while (!mDeltaStop)
+        {
+            mDeltaCond.wait(lock, [this]{ return mDeltaStop || !mPendingDeltas.empty(); });
+            if (mDeltaStop)
+                break;
+
+            const std::string endpt = *mPendingDeltas.begin();
+            mPendingDeltas.erase(mPendingDeltas.begin());
+            lock.unlock();
+            const RepositoryStruct repo = getRepository(endpt);
+            if (repo.id != 0)
+                createDelta(repo);
+            lock.lock();
+        }
+    }
+
+    /// @brief 產生前一版本到此版本的差異檔，差異太大(不如直接下載)時不產生
+    ///        版本檔案不會被改寫，比對期間不必鎖定範本，存入時才確認仍是目前版本
+    void createDelta(const RepositoryStruct& repo)
+    {
+        if (repo.prevfile.empty())
+            return;
+
+        try
+        {
+            const LocalFile sourceFile = mStorage->getLocalFile(repo.prevfile);
+            const LocalFile targetFile = getTemplateFile(repo);
+            if (sourceFile.empty() || targetFile.empty()
+                || Poco::File(sourceFile.path()).getSize() > MaxDeltaFileSize
+                || Poco::File(targetFile.path()).getSize() > MaxDeltaFileSize)
+                return;
+
+            const std::string source = readFile(sourceFile.path());
+            const std::string target = readFile(targetFile.path());
+            const std::string delta = BinaryDelta::create(source, target);
+            if (delta.size() > target.size() * 3 / 4)
+                return;
+
+            // 差異檔只是加速下載，會超過容量上限時不產生
+            if (mQuotaBytes != 0 && getRepositoryUsage() + delta.size() > mQuotaBytes)
+                return;
+
+            // 確認差異檔可以還原出新版本
+            std::string restored;
+            if (!BinaryDelta::apply(source, delta, restored) || restored != target)
+            {
+                LOG_ERR("Admin module [" << getDetail().name << "] invalid delta:" << repo.endpt);
+                return;
+            }
+
+            const std::string deltaFile = Poco::TemporaryFile::tempName(getTempPath());
+            {
+                std::ofstream out(deltaFile, std::ios::binary);
+                out.write(delta.data(), delta.size());
+            }
+
+            // 期間若已更新成其他版本，差異檔已被停用，不再存入
+            const auto readLock = mEndptLocks.lockRead(repo.endpt);
+            if (getRepository(repo.endpt).version != repo.version)
+            {
+                Poco::File(deltaFile).remove();
+                return;
+            }
+            mStorage->store(deltaFile, TemplateCatalog::getDeltaFileName(repo));
+            Poco::File(deltaFile).remove();
+
+            // 差異檔計入倉庫用量
+            unsigned long deltasize = delta.size();
+            auto session = getDataSession();
+            session << "UPDATE repository SET deltasize=? WHERE endpt=? AND version=?",
+                    use(deltasize), use(repo.endpt), use(repo.version), now;
+        }
+        catch(const Poco::Exception& exc)
+        {
+            LOG_ERR("Admin module [" << getDetail().name << "] create delta:" << exc.displayText());
+        }
     }
 };
 
@@ -0,0 +1,322 @@
+/// @brief 多執行緒同時對相同的 endpt 新增、更新、刪除及讀取範本
+///        使用模組的 TemplateCatalog(SQLite 資料表及 BEGIN IMMEDIATE transaction)及相同的鎖定方式：
+///        寫入持有 lockWrite(endpt)，先存入版本檔案再更新資料表，失敗時刪除剛存入的檔案；
+///        讀取持有 lockRead(endpt)，停用的版本由另一個執行緒隨時清除
+///        更新後存入差異檔(對應背景產生的差異檔)，舊版本改爲前一版本
+///        結束後檢查每筆範本都有正確的檔案，停用紀錄不會指向使用中的檔案，倉庫內也沒有多餘的檔案
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/TemporaryFile.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Tuple.h>
+#include <Poco/Data/Session.h>
+#include <Poco/Data/SessionPool.h>
+#include <Poco/Data/SQLite/Connector.h>
+
+#include "StorageBackend.hpp"
+#include "StripedLock.hpp"
+#include "TemplateCatalog.hpp"
+
+using namespace Poco::Data::Keywords;
+
+namespace
+{
+    constexpr int Threads = 8;
+    constexpr int Iterations = 500;
+    /// endpt 數量少於執行緒數，同一個 endpt 一定會同時被存取
+    constexpr int Endpts = 6;
+
+    using RepositoryStruct = TemplateCatalog::RepositoryStruct;
+
+    std::string readFile(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string& path, const std::string& content)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << content;
+    }
+
+    /// @brief 每個版本檔案的內容都不同，讀取時可以確認拿到的是資料表指向的版本
+    std::string getContent(const RepositoryStruct& repo)
+    {
+        return repo.endpt + ":" + repo.version;
+    }
+}
+
+int main()
+{
+    const std::string root = Poco::TemporaryFile::tempName() + "/";
+    const std::string incoming = root + "incoming/";
+    Poco::File(incoming).createDirectories();
+
+    Poco::Data::SQLite::Connector::registerConnector();
+    Poco::Data::SessionPool sessionPool("SQLite", root + "data.db", 1, Threads + 2);
+    {
+        auto session = sessionPool.get();
+        std::string journalMode;
+        session << "PRAGMA journal_mode=WAL", into(journalMode), now;
+        TemplateCatalog::createTables(session);
+    }
+
+    LocalStorage storage(root + "repository");
+    TemplateCatalog catalog(storage);
+    StripedLock locks;
+    std::atomic<unsigned long> sequence(0);
+    std::atomic<unsigned long> errors(0);
+    std::atomic<unsigned long> updates(0);
+    std::atomic<unsigned long> rejected(0);
+    std::atomic<unsigned long> reads(0);
+    std::atomic<bool> done(false);
+
+    auto fail = [&errors](const std::string& message)
+    {
+        static std::mutex outputMutex;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cerr << "FAIL: " << message << std::endl;
+        ++errors;
+    };
+
+    // 對應 updateRepositoryData()，失敗時和 /upload、/update 一樣刪除剛存入的檔案
+    // 只有新增已存在的 endpt(UNIQUE)應該失敗，其他失敗(例如 SQLITE_BUSY)都是錯誤
+    auto update = [&](Poco::Data::Session& session, const TemplateCatalog::ActionType type,
+                      RepositoryStruct& repo, const bool conflict)
+    {
+        TemplateCatalog::UpdateResult result = TemplateCatalog::UPDATE_FAILED;
+        unsigned long revision = 0;
+        std::string message;
+        try
+        {
+            result = catalog.update(session, type, repo, 0, revision);
+        }
+        catch (const Poco::Exception& exc)
+        {
+            // 資料表已 rollback
+            message = exc.displayText();
+        }
+
+        if (result == TemplateCatalog::UPDATE_OK)
+        {
+            if (conflict)
+                fail(repo.endpt + ": adding an existing endpt succeeded");
+            ++updates;
+        }
+        else
+        {
+            if (!conflict)
+                fail(repo.endpt + ": " + TemplateCatalog::ActionName[type] + " failed: " + message);
+            if (type != TemplateCatalog::DELETE)
+                storage.remove(TemplateCatalog::getShardedFileName(repo));
+            ++rejected;
+        }
+    };
+
+    auto worker = [&](const int id)
+    {
+        std::mt19937 random(id);
+        auto session = sessionPool.get();
+        for (int i = 0; i < Iterations; i++)
+        {
+            const std::string endpt = "endpt-" + std::to_string(random() % Endpts);
+            const unsigned int action = random() % 10;
+            try
+            {
+                if (action < 5)
+                {
+                    // 存入新版本：/upload 只新增，/update 原本有資料就更新
+                    const auto writeLock = locks.lockWrite(endpt);
+                    RepositoryStruct repo = TemplateCatalog::get(session, endpt);
+                    const bool conflict = action < 2 && repo.id != 0;
+                    const TemplateCatalog::ActionType type = action < 2 || repo.id == 0
+                        ? TemplateCatalog::ADD : TemplateCatalog::UPDATE;
+
+                    repo.endpt   = endpt;
+                    repo.extname = "ott";
+                    repo.version = std::to_string(++sequence);
+                    const std::string content = getContent(repo);
+                    repo.size    = content.size();
+
+                    const std::string receivedFile = incoming + repo.version;
+                    writeFile(receivedFile, content);
+                    storage.store(receivedFile, TemplateCatalog::getShardedFileName(repo));
+                    Poco::File(receivedFile).remove();
+
+                    update(session, type, repo, conflict);
+
+                    // 對應 createDelta()：確認仍是目前版本後存入差異檔並記錄大小
+                    if (type == TemplateCatalog::UPDATE && !repo.prevfile.empty()
+                        && TemplateCatalog::get(session, endpt).version == repo.version)
+                    {
+                        const std::string delta = "delta:" + repo.version;
+                        writeFile(receivedFile, delta);
+                        storage.store(receivedFile, TemplateCatalog::getDeltaFileName(repo));
+                        Poco::File(receivedFile).remove();
+
+                        unsigned long deltasize = delta.size();
+                        session << "UPDATE repository SET deltasize=? WHERE endpt=? AND version=?",
+                                use(deltasize), use(repo.endpt), use(repo.version), now;
+                    }
+                }
+                else if (action == 5)
+                {
+                    // 停用(對應 /delete)
+                    const auto writeLock = locks.lockWrite(endpt);
+                    RepositoryStruct repo = TemplateCatalog::get(session, endpt);
+                    if (repo.id != 0)
+                        update(session, TemplateCatalog::DELETE, repo, false);
+                }
+                else
+                {
+                    // 讀取(對應 /download)，持有讀取鎖期間檔案必須存在且內容正確
+                    const auto readLock = locks.lockRead(endpt);
+                    const RepositoryStruct repo = TemplateCatalog::get(session, endpt);
+                    if (repo.id == 0)
+                        continue;
+
+                    const LocalFile file = storage.getLocalFile(catalog.locateTemplateFile(repo));
+                    if (file.empty())
+                        fail(endpt + ": version " + repo.version + " is missing");
+                    else if (readFile(file.path()) != getContent(repo))
+                        fail(endpt + ": version " + repo.version + " has unexpected content");
+
+                    // 前一版本在成爲目前版本以外的檔案前，不能被清除
+                    if (!repo.prevfile.empty() && !storage.exists(repo.prevfile))
+                        fail(endpt + ": previous version " + repo.prevfile + " is missing");
+                    if (repo.deltasize != 0 && !storage.exists(TemplateCatalog::getDeltaFileName(repo)))
+                        fail(endpt + ": delta of version " + repo.version + " is missing");
+                    ++reads;
+                }
+            }
+            catch (const Poco::Exception& exc)
+            {
+                fail(endpt + ": " + exc.displayText());
+            }
+        }
+    };
+
+    // 對應 collectRetiredVersions()，不保留，停用的檔案隨時可能被刪除
+    std::thread collector([&]()
+    {
+        auto session = sessionPool.get();
+        while (!done)
+        {
+            try
+            {
+                unsigned long bytes = 0;
+                unsigned long files = 0;
+                catalog.collectRetired(session, Poco::Timestamp().epochTime(), bytes, files);
+            }
+            catch (const Poco::Exception& exc)
+            {
+                fail("collect retired: " + exc.displayText());
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (int id = 0; id < Threads; id++)
+        workers.emplace_back(worker, id);
+    for (auto& thread : workers)
+        thread.join();
+
+    done = true;
+    collector.join();
+
+    auto session = sessionPool.get();
+
+    // 每筆範本都要有檔案，而且內容是資料表指向的版本
+    std::set<std::string> live;
+    std::vector<std::string> endpts;
+    session << "SELECT endpt FROM repository", into(endpts), now;
+    for (const auto& endpt : endpts)
+    {
+        const RepositoryStruct repo = TemplateCatalog::get(session, endpt);
+        const std::string name = catalog.locateTemplateFile(repo);
+        live.insert(name);
+        if (!storage.exists(name))
+            fail(endpt + ": missing file " + name);
+        else if (readFile(storage.getPath(name)) != getContent(repo))
+            fail(endpt + ": " + name + " does not match the catalog");
+
+        // 前一版本及差異檔也在使用中
+        if (!repo.prevfile.empty())
+        {
+            live.insert(repo.prevfile);
+            if (!storage.exists(repo.prevfile))
+                fail(endpt + ": missing previous version " + repo.prevfile);
+        }
+        const std::string deltaName = TemplateCatalog::getDeltaFileName(repo);
+        if (repo.deltasize != 0)
+        {
+            live.insert(deltaName);
+            if (!storage.exists(deltaName))
+                fail(endpt + ": missing delta " + deltaName);
+        }
+        else if (storage.exists(deltaName))
+            fail(endpt + ": delta " + deltaName + " is not recorded");
+    }
+
+    // 停用紀錄只能指向已不使用、而且尚未刪除的檔案
+    std::vector<std::string> retiredFiles;
+    session << "SELECT file FROM retired", into(retiredFiles), now;
+    for (const auto& name : retiredFiles)
+    {
+        if (live.count(name) != 0)
+            fail("retired file " + name + " is still in use");
+        else if (!storage.exists(name))
+            fail("retired file " + name + " is already gone");
+    }
+
+    // 每次成功的異動都有一筆變更紀錄
+    unsigned long changes = 0;
+    session << "SELECT COUNT(*) FROM changelog", into(changes), now;
+    if (changes != updates)
+        fail("changelog has " + std::to_string(changes) + " rows, expected " + std::to_string(updates));
+
+    // 停用的檔案全部清除後，倉庫內只剩使用中的檔案(沒有孤兒檔或 .part)
+    unsigned long bytes = 0;
+    unsigned long files = 0;
+    catalog.collectRetired(session, Poco::Timestamp().epochTime() + 1, bytes, files);
+
+    unsigned long remaining = 0;
+    session << "SELECT COUNT(*) FROM retired", into(remaining), now;
+    if (remaining != 0)
+        fail(std::to_string(remaining) + " retired rows left after collection");
+
+    const std::vector<std::string> names = storage.list();
+    const std::set<std::string> actual(names.begin(), names.end());
+    for (const auto& name : actual)
+    {
+        if (live.count(name) == 0)
+            fail("orphan file " + name);
+    }
+    for (const auto& name : live)
+    {
+        if (actual.count(name) == 0)
+            fail("missing file " + name);
+    }
+
+    Poco::File(root).remove(true);
+
+    std::cout << Threads << " threads, " << Iterations << " iterations, "
+              << updates << " updates, " << rejected << " rejected, "
+              << reads << " reads, " << live.size() << " templates, "
+              << errors << " errors" << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+/// @brief TieredStorage 的快取行爲：讀取時複製(miss 之後 hit)、正本變動時重新複製、
+///        超過容量時移除最久未使用的檔案，以及正在讀取(LocalFile 未釋放)的檔案不會被移除
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/TemporaryFile.h>
+#include <Poco/Timestamp.h>
+
+#include "StorageBackend.hpp"
+
+namespace
+{
+    /// 快取容量，剛好放得下兩個測試檔案
+    constexpr Poco::File::FileSize MaxCacheBytes = 100;
+
+    int errors = 0;
+
+    void check(const bool condition, const std::string& message)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAIL: " << message << std::endl;
+            ++errors;
+        }
+    }
+
+    std::string readFile(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string& path, const std::string& content)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << content;
+    }
+
+    /// @brief 40 bytes 的檔案內容
+    std::string makeContent(const char ch)
+    {
+        return std::string(40, ch);
+    }
+}
+
+int main()
+{
+    const std::string root = Poco::TemporaryFile::tempName() + "/";
+    const std::string backingRoot = root + "backing/";
+    const std::string cacheRoot = root + "cache/";
+
+    try
+    {
+        TieredStorage storage(backingRoot, cacheRoot, MaxCacheBytes);
+
+        // 直接放進正本目錄，不經過 store() 的同步寫入
+        Poco::File(backingRoot + "aa").createDirectories();
+        for (const char ch : {'a', 'b', 'c', 'd'})
+            writeFile(backingRoot + "aa/" + ch + ".ott", makeContent(ch));
+
+        // 1. 第一次讀取(miss)：從正本複製到快取，傳回快取路徑
+        {
+            const LocalFile file = storage.getLocalFile("aa/a.ott");
+            check(file.path() == cacheRoot + "aa/a.ott", "miss should return the cache path");
+            check(readFile(file.path()) == makeContent('a'), "miss should copy the content");
+        }
+
+        // 2. 再次讀取(hit)：正本沒變就直接用快取，不重新複製
+        //    先改掉快取檔的內容(大小不變)，若有重新複製就會讀到正本的內容
+        writeFile(cacheRoot + "aa/a.ott", makeContent('x'));
+        {
+            const LocalFile file = storage.getLocalFile("aa/a.ott");
+            check(file.path() == cacheRoot + "aa/a.ott", "hit should return the cache path");
+            check(readFile(file.path()) == makeContent('x'), "hit should not copy again");
+        }
+
+        // 3. 正本的修改時間不同(大小相同)：視爲過期，重新複製
+        Poco::File(backingRoot + "aa/a.ott").setLastModified(
+            Poco::File(backingRoot + "aa/a.ott").getLastModified() - Poco::Timestamp::resolution());
+        {
+            const LocalFile file = storage.getLocalFile("aa/a.ott");
+            check(readFile(file.path()) == makeContent('a'), "mtime change should copy again");
+        }
+
+        // 4. 正本的大小不同：視爲過期，重新複製
+        writeFile(backingRoot + "aa/a.ott", makeContent('a') + "a");
+        {
+            const LocalFile file = storage.getLocalFile("aa/a.ott");
+            check(readFile(file.path()) == makeContent('a') + "a", "size change should copy again");
+        }
+
+        // 5. 超過容量：移除最久未使用的檔案(a)
+        storage.getLocalFile("aa/b.ott");
+        storage.getLocalFile("aa/c.ott");
+        check(!Poco::File(cacheRoot + "aa/a.ott").exists(), "least recently used file should be evicted");
+        check(Poco::File(cacheRoot + "aa/b.ott").exists(), "b should stay cached");
+        check(Poco::File(cacheRoot + "aa/c.ott").exists(), "c should stay cached");
+
+        // 6. 正在讀取的檔案不會被移除
+        {
+            const LocalFile pinned = storage.getLocalFile("aa/b.ott");
+            // c 變成最久未使用的，接著讀 d、a 都會需要空間
+            storage.getLocalFile("aa/c.ott");
+            storage.getLocalFile("aa/d.ott");
+            storage.getLocalFile("aa/a.ott");
+            check(Poco::File(pinned.path()).exists(), "pinned file should survive eviction");
+            check(readFile(pinned.path()) == makeContent('b'), "pinned file should keep its content");
+
+            // 刪除正本時，快取檔仍保留到讀取結束
+            storage.remove("aa/b.ott");
+            check(!storage.exists("aa/b.ott"), "remove should delete the backing file");
+            check(Poco::File(pinned.path()).exists(), "pinned file should survive remove");
+        }
+
+        // 7. 釋放之後，下次讀取發現正本已刪除，就一併移除快取檔
+        check(storage.getLocalFile("aa/b.ott").empty(), "removed file should not be found");
+        check(!Poco::File(cacheRoot + "aa/b.ott").exists(), "unpinned file should be dropped");
+
+        // 8. 重新啓動時載入既有的快取，並降到容量上限以下
+        {
+            TieredStorage reloaded(backingRoot, cacheRoot, 50);
+            int cached = 0;
+            for (const char ch : {'a', 'c', 'd'})
+            {
+                if (Poco::File(cacheRoot + "aa/" + ch + ".ott").exists())
+                    ++cached;
+            }
+            check(cached <= 1, "reloaded cache should be evicted below the limit");
+        }
+    }
+    catch (const Poco::Exception& exc)
+    {
+        check(false, exc.displayText());
+    }
+
+    Poco::File(root).remove(true);
+
+    std::cout << errors << " errors" << std::endl;
+    return errors == 0 ? 0 : 1;
+}